@@ -1,140 +1,1735 @@
 #include "analyzer.h"
-#include <unordered_map>
+#include "csv_scan.h"
+#include "zone_dict.h"
+#include "topk.h"
+#include "gz_reader.h"
+#include "spsc_queue.h"
 #include <vector>
 #include <array>
 #include <string>
-#include <fstream>
+#include <string_view>
 #include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <cstring>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <atomic>
+#include <chrono>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using namespace std;
 
 namespace {
 
-inline void trim(string& s) {
-    size_t b = 0;
-    while (b < s.size() && isspace((unsigned char)s[b])) b++;
-    size_t e = s.size();
-    while (e > b && isspace((unsigned char)s[e - 1])) e--;
-    s = s.substr(b, e - b);
-}
-
-vector<string> splitCSV(const string& line) {
-    vector<string> out;
-    size_t start = 0;
-    while (start <= line.size()) {
-        size_t pos = line.find(',', start);
-        if (pos == string::npos) pos = line.size();
-        string field = line.substr(start, pos - start);
-        trim(field);
-        out.push_back(field);
-        if (pos == line.size()) break;
-        start = pos + 1;
+inline string_view trimmed(const char* b, const char* e) {
+    while (b < e && isspace((unsigned char)*b)) b++;
+    while (e > b && isspace((unsigned char)e[-1])) e--;
+    return string_view(b, e - b);
+}
+
+// Splits a byte range into rows of trimmed fields without copying: every
+// field is a view into the input. Delimiters come from the SIMD structural
+// scanner; a row is only tokenized up to the last column the caller asks
+// for, and the rest of it is skipped via the newline mask.
+class CsvReader {
+public:
+    CsvReader(const char* begin, const char* end) : p(begin), end(end), scan(begin, end) {}
+
+    // Reads up to `want` leading fields of the next row into f and returns
+    // how many the row had (capped at want), or -1 once the range is used up.
+    int next(string_view* f, int want) {
+        if (p >= end) return -1;
+
+        int n = 0;
+        const char* s = p;
+        for (;;) {
+            const char* q = scan.nextDelim(s);
+            f[n++] = trimmed(s, q);
+
+            if (q == end || *q == '\n') {
+                p = q == end ? end : q + 1;
+                return n;
+            }
+            if (n == want) {
+                const char* nl = scan.nextNewline(q);
+                p = nl == end ? end : nl + 1;
+                return n;
+            }
+            s = q + 1;
+        }
     }
-    return out;
+
+private:
+    const char* p;
+    const char* end;
+    CsvScanner scan;
+};
+
+// ---------------- timestamp parsing ----------------
+
+bool isLeapYear(int y) {
+    return (y % 4 == 0) & ((y % 100 != 0) | (y % 400 == 0));
+}
+
+bool validDate(int year, int month, int day) {
+    // Padded to 16 so any month & 15 indexes it; months past 12 fail below.
+    static const int kDays[16] = {0, 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    int days = kDays[month & 15] + ((month == 2) & isLeapYear(year));
+    return (month >= 1) & (month <= 12) & (day >= 1) & (day <= days);
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+
+// Fixed-layout "YYYY-MM-DD HH:MM", read as two little-endian words. Each
+// byte is XORed with what the layout expects there ('0' for digits, the
+// separator itself otherwise), which leaves digit values 0-9 and zero
+// separators in a well-formed field. All checks are then word-wide masks.
+bool parseStrict16(const char* s, int& hour) {
+    const uint64_t kDigit0 = 0x3030303030303030ull;
+    // Byte 4 '-', byte 7 '-' / byte 2 ' ', byte 5 ':'.
+    const uint64_t kWant0 = kDigit0 ^ (0x30ull << 32) ^ (0x30ull << 56) ^ ((uint64_t)'-' << 32) ^ ((uint64_t)'-' << 56);
+    const uint64_t kWant1 = kDigit0 ^ (0x30ull << 16) ^ (0x30ull << 40) ^ ((uint64_t)' ' << 16) ^ ((uint64_t)':' << 40);
+    const uint64_t kSep0 = 0xFFull << 32 | 0xFFull << 56;
+    const uint64_t kSep1 = 0xFFull << 16 | 0xFFull << 40;
+    const uint64_t kHigh = 0x8080808080808080ull;
+
+    uint64_t w0, w1;
+    memcpy(&w0, s, 8);
+    memcpy(&w1, s + 8, 8);
+    uint64_t x0 = w0 ^ kWant0;
+    uint64_t x1 = w1 ^ kWant1;
+
+    // A digit byte is 0-9 iff neither it nor it + 0x76 has the top bit set.
+    uint64_t bad = ((x0 | (x0 + 0x7676767676767676ull)) & kHigh & ~kSep0) |
+                   ((x1 | (x1 + 0x7676767676767676ull)) & kHigh & ~kSep1) |
+                   (x0 & kSep0) | (x1 & kSep1);
+
+    auto at = [](uint64_t x, int i) { return (int)((x >> (8 * i)) & 0xFF); };
+    int year   = at(x0, 0) * 1000 + at(x0, 1) * 100 + at(x0, 2) * 10 + at(x0, 3);
+    int month  = at(x0, 5) * 10 + at(x0, 6);
+    int day    = at(x1, 0) * 10 + at(x1, 1);
+    int h      = at(x1, 3) * 10 + at(x1, 4);
+    int minute = at(x1, 6) * 10 + at(x1, 7);
+
+    bool ok = (bad == 0) & validDate(year, month, day) & (h <= 23) & (minute <= 59);
+    hour = h;
+    return ok;
+}
+
+#else
+
+bool parseStrict16(const char*, int&) { return false; }
+
+#endif
+
+// Digits in [p, end) as a number, or -1 if there are none, a non-digit, or
+// more than maxDigits.
+int digitsValue(const char* p, const char* end, size_t maxDigits) {
+    if (p == end || (size_t)(end - p) > maxDigits) return -1;
+    int v = 0;
+    for (; p < end; p++) {
+        if (!isdigit((unsigned char)*p)) return -1;
+        v = v * 10 + (*p - '0');
+    }
+    return v;
 }
 
-bool parseHour(const string& dt, int& hour) {
+// Looser layouts: one-digit hours or months, trailing seconds, or a date
+// that is not Y-M-D at all. A Y-M-D date must still be a real one.
+bool parseHourTolerant(string_view dt, int& hour) {
     size_t space = dt.find(' ');
-    if (space == string::npos || space + 1 >= dt.size()) return false;
+    if (space == string_view::npos || space + 1 >= dt.size()) return false;
 
     size_t colon = dt.find(':', space + 1);
-    if (colon == string::npos) return false;
+    if (colon == string_view::npos) return false;
 
-    string h = dt.substr(space + 1, colon - (space + 1));
-    if (h.empty() || h.size() > 2) return false;
+    const char* s = dt.data();
+    int val = digitsValue(s + space + 1, s + colon, 2);
+    if (val < 0 || val > 23) return false;
+
+    size_t minEnd = dt.find(':', colon + 1);
+    if (minEnd == string_view::npos) minEnd = dt.size();
+    int minute = digitsValue(s + colon + 1, s + minEnd, 2);
+    if (minute < 0 || minute > 59) return false;
 
-    int val = 0;
-    for (char c : h) {
-        if (!isdigit((unsigned char)c)) return false;
-        val = val * 10 + (c - '0');
+    size_t dash1 = dt.find('-');
+    size_t dash2 = dash1 < space ? dt.find('-', dash1 + 1) : string_view::npos;
+    if (dash2 < space) {
+        int year  = digitsValue(s, s + dash1, 4);
+        int month = digitsValue(s + dash1 + 1, s + dash2, 2);
+        int day   = digitsValue(s + dash2 + 1, s + space, 2);
+        if ((year >= 0) & (month >= 0) & (day >= 0) && !validDate(year, month, day))
+            return false;
     }
 
-    if (val < 0 || val > 23) return false;
     hour = val;
     return true;
 }
 
+// Hour (0-23) of a pickup timestamp. The common "YYYY-MM-DD HH:MM" layout
+// (optionally with ":SS") takes the branch-free path.
+bool parseHour(string_view dt, int& hour) {
+    if (dt.size() == 16 || (dt.size() == 19 && dt[16] == ':')) {
+        if (parseStrict16(dt.data(), hour)) {
+            if (dt.size() == 16) return true;
+            int second = digitsValue(dt.data() + 17, dt.data() + 19, 2);
+            return second >= 0 && second <= 59;
+        }
+    }
+    return parseHourTolerant(dt, hour);
 }
 
-static unordered_map<string, int> zoneId;
-static vector<string> idZone;
-static vector<long long> zoneTotal;
-static vector<array<long long, 24>> zoneHour;
+// Read-only view of a whole input file. Regular files are mapped so rows are
+// parsed straight out of the page cache; anything that cannot be mapped
+// (pipes, FIFOs, character devices) is drained with large read() calls.
+class InputFile {
+public:
+    // "-" names standard input. Regular files are mapped whole; pipes,
+    // FIFOs and terminals are left to be drained with readSome().
+    explicit InputFile(const string& path) {
+        if (path == "-") {
+            fd = STDIN_FILENO;
+            owned = false;
+        } else {
+            fd = open(path.c_str(), O_RDONLY);
+        }
+        if (fd < 0) return;
 
-void TripAnalyzer::ingestFile(const string& csvPath) {
-    zoneId.clear();
-    idZone.clear();
-    zoneTotal.clear();
-    zoneHour.clear();
+        struct stat st;
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+            regular = true;
+            inodeNo = (uint64_t)st.st_ino;
+            mtimeNs = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+            len = (size_t)st.st_size;
+            if (len == 0) return;
+            void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                madvise(p, len, MADV_SEQUENTIAL);
+                mapped = static_cast<const char*>(p);
+                return;
+            }
+            readAll();
+        }
+    }
 
-    ifstream file(csvPath);
-    if (!file.is_open()) return;
+    ~InputFile() {
+        if (mapped) munmap(const_cast<char*>(mapped), len);
+        if (fd >= 0 && owned) close(fd);
+    }
 
-    string line;
-    bool first = true;
+    InputFile(const InputFile&) = delete;
+    InputFile& operator=(const InputFile&) = delete;
 
-    while (getline(file, line)) {
-        if (first) { first = false; continue; }
-        if (line.empty()) continue;
+    bool ok() const { return fd >= 0; }
+    bool isRegular() const { return regular; }
+    int64_t mtime() const { return mtimeNs; }
+    uint64_t inode() const { return inodeNo; }
+    const char* data() const { return mapped ? mapped : buf.data(); }
+    size_t size() const { return mapped ? len : buf.size(); }
 
-        auto fields = splitCSV(line);
-        if (fields.size() < 3) continue;
+    // Next bytes of a non-regular source; 0 at end of input or on error.
+    size_t readSome(char* dst, size_t n) {
+        for (;;) {
+            ssize_t got = read(fd, dst, n);
+            if (got >= 0) return (size_t)got;
+            if (errno != EINTR) return 0;
+        }
+    }
 
-        const string& zone = fields[1];
-        const string& dt   = fields[2];
-        if (zone.empty() || dt.empty()) continue;
+private:
+    void readAll() {
+        const size_t chunk = 1 << 20;
+        buf.clear();
+        for (;;) {
+            size_t used = buf.size();
+            buf.resize(used + chunk);
+            ssize_t n = read(fd, buf.data() + used, chunk);
+            if (n < 0 && errno == EINTR) { buf.resize(used); continue; }
+            buf.resize(used + (n > 0 ? (size_t)n : 0));
+            if (n <= 0) break;
+        }
+    }
 
-        int hour;
-        if (!parseHour(dt, hour)) continue;
+    int fd = -1;
+    bool owned = true;
+    bool regular = false;
+    uint64_t inodeNo = 0;
+    int64_t mtimeNs = 0;
+    const char* mapped = nullptr;
+    size_t len = 0;
+    vector<char> buf;
+};
 
-        int id;
-        auto it = zoneId.find(zone);
-        if (it == zoneId.end()) {
-            id = (int)idZone.size();
-            zoneId[zone] = id;
-            idZone.push_back(zone);
+// Per-zone aggregates. Ids are handed out in first-appearance order and
+// each zone name is stored once, in the dictionary's arena.
+struct ZoneTable {
+    ZoneDict zones;
+    ZoneNumberIndex numbered;
+    vector<long long> zoneTotal;
+    vector<array<long long, 24>> zoneHour;
+
+    void clear() {
+        zones.clear();
+        numbered.clear();
+        zoneTotal.clear();
+        zoneHour.clear();
+    }
+
+    void reserve(size_t n, size_t nameBytes) {
+        zones.reserve(n, nameBytes);
+        zoneTotal.reserve(n);
+        zoneHour.reserve(n);
+    }
+
+    int idFor(string_view zone) {
+        uint32_t* direct = numbered.slot(zone, zones.size());
+        if (!direct) return intern(zone);
+        if (*direct == ZoneDict::npos) *direct = (uint32_t)intern(zone);
+        return (int)*direct;
+    }
+
+    int intern(string_view zone) { return intern(zone, ZoneDict::tagOf(zone)); }
+
+    int intern(string_view zone, uint32_t tag) {
+        int id = (int)zones.intern(zone, tag);
+        if (id == (int)zoneTotal.size()) {
             zoneTotal.push_back(0);
             zoneHour.push_back({});
-        } else {
-            id = it->second;
         }
+        return id;
+    }
 
+    void count(int id, int hour) {
         zoneTotal[id]++;
         zoneHour[id][hour]++;
     }
+
+    // Adds o's counts into this table. Zones new to this table are appended
+    // in o's id order, so merging chunk tables in file order reproduces the
+    // ids a serial pass would have assigned.
+    void mergeFrom(const ZoneTable& o) {
+        for (size_t i = 0; i < o.zones.size(); i++) {
+            int id = idFor(o.zones.key((uint32_t)i));
+            zoneTotal[id] += o.zoneTotal[i];
+            for (int h = 0; h < 24; h++) zoneHour[id][h] += o.zoneHour[i][h];
+        }
+    }
+};
+
+// Positions of the fields ingest reads. The default is the
+// TripID,PickupZoneID,PickupTime layout.
+struct Columns {
+    int zone = 1;
+    int time = 2;
+
+    // Fields a row must have; tokenizing stops after the last of them.
+    int needed() const { return max(zone, time) + 1; }
+};
+
+// Upper bound on header fields inspected when resolving columns.
+const int kMaxHeaderFields = 256;
+
+// Works out the column layout from the first line of [p, end) and returns
+// where the data rows begin. A line naming either column is a header; the
+// columns it names are used and a missing one keeps its default position.
+// A line naming neither, but with a timestamp after the zone column, is
+// taken as the first data row of a headerless file. Its first such field
+// is used as the time column. Any other line is skipped as a header and
+// the default layout is kept.
+const char* readHeader(const char* p, const char* end, const string& zoneName,
+                       const string& timeName, Columns& cols) {
+    CsvReader reader(p, end);
+    vector<string_view> f(kMaxHeaderFields);
+    int n = reader.next(f.data(), kMaxHeaderFields);
+    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+    const char* data = nl ? nl + 1 : end;
+    cols = Columns();
+    if (n <= 0) return data;
+
+    int zone = -1, time = -1;
+    for (int i = 0; i < n; i++) {
+        if (f[i] == zoneName && zone < 0) zone = i;
+        if (f[i] == timeName && time < 0) time = i;
+    }
+    if (zone >= 0 || time >= 0) {
+        if (zone >= 0) cols.zone = zone;
+        if (time >= 0) cols.time = time;
+        return data;
+    }
+
+    int hour;
+    for (int i = cols.zone + 1; i < n; i++) {
+        if (parseHour(f[i], hour)) {
+            cols.time = i;
+            return p;
+        }
+    }
+    return data;
 }
 
-vector<ZoneCount> TripAnalyzer::topZones(int k) const {
-    vector<ZoneCount> all;
-    for (size_t i = 0; i < idZone.size(); i++)
-        all.push_back({idZone[i], zoneTotal[i]});
+// Zone id and hour of every accepted row, in file order. Recorded only
+// when a sidecar cache is going to be written.
+struct RowLog {
+    vector<uint32_t> zone;
+    vector<uint8_t> hour;
+};
 
-    sort(all.begin(), all.end(), [](const ZoneCount& a, const ZoneCount& b) {
-        if (a.count != b.count) return a.count > b.count;
-        return a.zone < b.zone;
+// Calls row(zone, hour) for every well-formed line in [p, end). The range
+// must start at the beginning of a line and must not contain the header.
+template <class Row>
+void forEachRow(const char* p, const char* end, Columns cols, Row&& row) {
+    CsvReader rows(p, end);
+    const int want = cols.needed();
+    vector<string_view> fields(want);
+    int n;
+
+    while ((n = rows.next(fields.data(), want)) >= 0) {
+        if (n < want) continue;
+
+        string_view zone = fields[cols.zone];
+        string_view dt   = fields[cols.time];
+        if (zone.empty() || dt.empty()) continue;
+
+        int hour;
+        if (!parseHour(dt, hour)) continue;
+        row(zone, hour);
+    }
+}
+
+// Adds rows to a table one at a time, with two shortcuts for clustered
+// input. The last few zone names are remembered by their raw bytes (names
+// of up to 8 bytes compare as one word), so a recently seen zone skips the
+// dictionary; a hit moves one place towards the front. A run of rows with
+// the same zone and hour is added to the counters in one step when it ends.
+// Names are kept as views, so the input must outlive the counter.
+template <size_t Slots>
+class RowCounter {
+public:
+    RowCounter(ZoneTable& t, RowLog* log) : t(t), log(log) {}
+
+    void add(string_view zone, int hour) {
+        int id = lookup(zone);
+        if (id == runId && hour == runHour) {
+            runLength++;
+        } else {
+            finish();
+            runId = id;
+            runHour = hour;
+            runLength = 1;
+        }
+        if (log) {
+            log->zone.push_back((uint32_t)id);
+            log->hour.push_back((uint8_t)hour);
+        }
+    }
+
+    // Adds the pending run. Call once the last row is in.
+    void finish() {
+        if (runLength == 0) return;
+        t.zoneTotal[runId] += runLength;
+        t.zoneHour[runId][runHour] += runLength;
+        runLength = 0;
+    }
+
+private:
+    struct Key {
+        uint64_t head;   // first 8 bytes, zero padded
+        string_view name;
+        int id;
+    };
+
+    int lookup(string_view zone) {
+        uint64_t head = 0;
+        memcpy(&head, zone.data(), min<size_t>(zone.size(), 8));
+        for (size_t i = 0; i < used; i++) {
+            if (keys[i].head == head && keys[i].name.size() == zone.size() &&
+                (zone.size() <= 8 || keys[i].name == zone)) {
+                int id = keys[i].id;
+                if (i > 0) swap(keys[i], keys[i - 1]);
+                return id;
+            }
+        }
+        int id = t.idFor(zone);
+        if (used < Slots) used++;
+        keys[used - 1] = {head, zone, id};
+        return id;
+    }
+
+    ZoneTable& t;
+    RowLog* log;
+    Key keys[Slots];
+    size_t used = 0;
+    int runId = -1;
+    int runHour = -1;
+    long long runLength = 0;
+};
+
+// Rows per batch of BatchCounter: enough independent lookups in flight to
+// cover a DRAM miss, few enough that their cache lines are still there
+// when the probes come.
+const size_t kBatchRows = 32;
+
+// The hash engine's counter. Rows are taken kBatchRows at a time and
+// resolved in passes, so the cache misses of one batch overlap instead of
+// being waited on one after another:
+//   1. a row naming the same zone as the row before it is marked as such;
+//      a zone the numbered index already knows gets its id (and its
+//      counters prefetched); every other name is hashed and its home slot
+//      in the dictionary prefetched;
+//   2. the remaining rows are looked up (or added) in order, and their
+//      counters prefetched;
+//   3. rows are counted, runs of equal (zone, hour) in one step.
+class BatchCounter {
+public:
+    BatchCounter(ZoneTable& t, RowLog* log) : t(t), log(log) {}
+
+    void add(string_view zone, int hour) {
+        Row& r = batch[n++];
+        r.zone = zone;
+        r.hour = (uint8_t)hour;
+        if (n == kBatchRows) flush();
+    }
+
+    // Adds the rows still pending. Call once the last row is in.
+    void finish() {
+        flush();
+        addRun();
+    }
+
+private:
+    enum Source : uint8_t { Known, SameAsPrevious, Numbered, Hashed };
+
+    struct Row {
+        string_view zone;
+        uint8_t hour;
+        Source source;
+        uint32_t tag;
+        int id;
+    };
+
+    void flush() {
+        for (size_t i = 0; i < n; i++) {
+            Row& r = batch[i];
+            if (r.zone == (i ? batch[i - 1].zone : lastZone)) {
+                r.source = SameAsPrevious;
+                continue;
+            }
+            uint32_t* direct = t.numbered.slot(r.zone, t.zones.size());
+            if (direct && *direct != ZoneDict::npos) {
+                r.source = Known;
+                r.id = (int)*direct;
+                prefetchCounters(r);
+                continue;
+            }
+            r.source = direct ? Numbered : Hashed;
+            r.tag = ZoneDict::tagOf(r.zone);
+            t.zones.prefetch(r.tag);
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            Row& r = batch[i];
+            if (r.source == SameAsPrevious) {
+                r.id = i ? batch[i - 1].id : lastId;
+            } else if (r.source != Known) {
+                uint32_t* direct = r.source == Numbered ? t.numbered.slot(r.zone, t.zones.size()) : nullptr;
+                if (direct && *direct != ZoneDict::npos) {
+                    r.id = (int)*direct;
+                } else {
+                    r.id = t.intern(r.zone, r.tag);
+                    if (direct) *direct = (uint32_t)r.id;
+                }
+                prefetchCounters(r);
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            const Row& r = batch[i];
+            if (r.id != runId || r.hour != runHour) {
+                addRun();
+                runId = r.id;
+                runHour = r.hour;
+            }
+            runLength++;
+            if (log) {
+                log->zone.push_back((uint32_t)r.id);
+                log->hour.push_back(r.hour);
+            }
+        }
+
+        if (n > 0) {
+            lastZone = batch[n - 1].zone;
+            lastId = batch[n - 1].id;
+        }
+        n = 0;
+    }
+
+    void prefetchCounters(const Row& r) const {
+        __builtin_prefetch(&t.zoneTotal[r.id], 1);
+        __builtin_prefetch(&t.zoneHour[r.id][r.hour], 1);
+    }
+
+    void addRun() {
+        if (runLength == 0) return;
+        t.zoneTotal[runId] += runLength;
+        t.zoneHour[runId][runHour] += runLength;
+        runLength = 0;
+    }
+
+    ZoneTable& t;
+    RowLog* log;
+    Row batch[kBatchRows];
+    size_t n = 0;
+    string_view lastZone;   // zone of the last row of the previous batch
+    int lastId = -1;
+    int runId = -1;
+    int runHour = -1;
+    long long runLength = 0;
+};
+
+// Aggregates every line in [p, end) into t, appending to log if one is
+// given.
+void ingestLines(const char* p, const char* end, Columns cols, ZoneTable& t,
+                 RowLog* log = nullptr) {
+    BatchCounter rows(t, log);
+    forEachRow(p, end, cols, [&](string_view zone, int hour) { rows.add(zone, hour); });
+    rows.finish();
+}
+
+// ---------------- aggregation engines ----------------
+
+// Aggregation strategy for one input, picked by planEngine from a sample.
+struct EnginePlan {
+    AggregationEngine engine = AggregationEngine::Hash;
+    size_t estimatedZones = 0;
+};
+
+const size_t kTinyZones = 16;
+const size_t kRadixMinZones = 256 << 10;
+const size_t kSampleWindows = 8;
+const size_t kSampleWindowBytes = 16 << 10;
+const size_t kSampleRows = 2048;
+
+// Number of zones that, drawn from evenly, would show `distinct` different
+// ones in `rows` draws: solves distinct = z * (1 - e^(-rows / z)) for z.
+// How often the sample repeats itself decides the estimate, so it does not
+// grow with the file the way distinct-per-row times rows does. A sample
+// without repeats only says "at least as many as the rows"; that is capped
+// at `maxZones`.
+size_t estimateZones(size_t rows, size_t distinct, size_t maxZones) {
+    auto seenOf = [rows](double z) { return z * -expm1(-(double)rows / z); };
+    if (distinct >= rows || seenOf((double)maxZones) <= (double)distinct) return maxZones;
+    double lo = (double)distinct, hi = (double)maxZones;
+    for (int i = 0; i < 64 && hi - lo > 1; i++) {
+        double mid = (lo + hi) / 2;
+        if (seenOf(mid) < (double)distinct) lo = mid;
+        else hi = mid;
+    }
+    return (size_t)hi;
+}
+
+// Parses a few windows spread over [p, end) (just the first kSampleRows
+// rows if it is small) and estimates the number of distinct zones from what
+// they hold: a handful seen many times means a tiny table, an estimate past
+// kRadixMinZones means radix partitioning, anything else the hash table.
+EnginePlan planEngine(const char* p, const char* end, Columns cols) {
+    unordered_set<string_view> seen;
+    size_t rows = 0, bytes = 0;
+    auto sample = [&](const char* a, const char* b) {
+        forEachRow(a, b, cols, [&](string_view zone, int) {
+            seen.insert(zone);
+            rows++;
+        });
+        bytes += (size_t)(b - a);
+    };
+
+    auto lineAfter = [end](const char* q) {
+        if (q >= end) return end;
+        const char* nl = static_cast<const char*>(memchr(q, '\n', end - q));
+        return nl ? nl + 1 : end;
+    };
+    size_t len = (size_t)(end - p);
+    if (len <= 2 * kSampleWindows * kSampleWindowBytes) {
+        const char* b = p;
+        for (size_t i = 0; i < kSampleRows && b < end; i++) b = lineAfter(b);
+        sample(p, b);
+    } else {
+        for (size_t w = 0; w < kSampleWindows; w++) {
+            const char* a = w == 0 ? p : lineAfter(p + len / kSampleWindows * w);
+            sample(a, lineAfter(a + kSampleWindowBytes));
+        }
+    }
+
+    EnginePlan plan;
+    if (rows == 0) return plan;
+    size_t estimatedRows = max(rows, (size_t)((double)rows * len / bytes));
+    if (seen.size() <= kTinyZones && rows >= 8 * seen.size()) {
+        plan.engine = AggregationEngine::Tiny;
+        plan.estimatedZones = seen.size();
+    } else {
+        plan.estimatedZones = estimateZones(rows, seen.size(), estimatedRows);
+        if (plan.estimatedZones >= kRadixMinZones) plan.engine = AggregationEngine::Radix;
+    }
+    return plan;
+}
+
+// Few zones: all of their names fit RowCounter's memo, which stays in L1,
+// so rows are matched without hashing. Zones past the first kTinyZones
+// still work, through the dictionary.
+void ingestLinesTiny(const char* p, const char* end, Columns cols, ZoneTable& t, RowLog* log) {
+    RowCounter<kTinyZones> rows(t, log);
+    forEachRow(p, end, cols, [&](string_view zone, int hour) { rows.add(zone, hour); });
+    rows.finish();
+}
+
+// Bytes of dictionary slots one radix partition should cover: about what
+// stays cache-resident while the partition is probed.
+const size_t kRadixSliceBytes = 256 << 10;
+
+// Rows the radix engine buffers before counting them. Bounds its working
+// set (a RadixRow and an order entry per row, about 7 MiB) whatever the
+// size of the input.
+const size_t kRadixBatchRows = 256 << 10;
+
+struct RadixRow {
+    const char* name;
+    uint32_t len;
+    uint32_t tag;
+    uint8_t hour;
+};
+
+// Counts one batch of rows, visited grouped by the top bits of their hash
+// tag. Those bits pick the home slot, so each group probes one slice of
+// the slot array while it is cached.
+void countRadixBatch(const vector<RadixRow>& rows, ZoneTable& t, RowLog* log) {
+    int bits = 0;
+    while (bits < 12 && (t.zones.capacity() * sizeof(ZoneDict::Slot) >> bits) > kRadixSliceBytes) bits++;
+
+    // Counting sort of row indices by partition.
+    vector<uint32_t> order(rows.size());
+    if (bits == 0) {
+        for (size_t i = 0; i < rows.size(); i++) order[i] = (uint32_t)i;
+    } else {
+        vector<uint32_t> start((size_t(1) << bits) + 1, 0);
+        for (const RadixRow& r : rows) start[(r.tag >> (32 - bits)) + 1]++;
+        for (size_t b = 1; b < start.size(); b++) start[b] += start[b - 1];
+        for (size_t i = 0; i < rows.size(); i++) order[start[rows[i].tag >> (32 - bits)]++] = (uint32_t)i;
+    }
+
+    vector<uint32_t> ids(log ? rows.size() : 0);
+    for (uint32_t i : order) {
+        const RadixRow& r = rows[i];
+        int id = t.intern(string_view(r.name, r.len), r.tag);
+        t.count(id, r.hour);
+        if (log) ids[i] = (uint32_t)id;
+    }
+    if (log) {
+        log->zone.insert(log->zone.end(), ids.begin(), ids.end());
+        for (const RadixRow& r : rows) log->hour.push_back(r.hour);
+    }
+}
+
+// Very many zones: every probe of a large dictionary is a cache miss. Rows
+// are parsed kRadixBatchRows at a time and each batch is counted grouped
+// by hash partition (see countRadixBatch). New zones get ids in group
+// order rather than file order; counts, names and rankings are the same.
+void ingestLinesRadix(const char* p, const char* end, Columns cols, ZoneTable& t, RowLog* log) {
+    vector<RadixRow> rows;
+    forEachRow(p, end, cols, [&](string_view zone, int hour) {
+        rows.push_back({zone.data(), (uint32_t)zone.size(), ZoneDict::tagOf(zone), (uint8_t)hour});
+        if (rows.size() == kRadixBatchRows) {
+            countRadixBatch(rows, t, log);
+            rows.clear();
+        }
     });
+    countRadixBatch(rows, t, log);
+}
 
-    if ((int)all.size() > k) all.resize(k);
-    return all;
+// Aggregates [p, end) into t with the planned engine.
+void ingestPlanned(const EnginePlan& plan, const char* p, const char* end, Columns cols,
+                   ZoneTable& t, RowLog* log) {
+    switch (plan.engine) {
+    case AggregationEngine::Tiny:
+        ingestLinesTiny(p, end, cols, t, log);
+        break;
+    case AggregationEngine::Radix:
+        ingestLinesRadix(p, end, cols, t, log);
+        break;
+    default:
+        ingestLines(p, end, cols, t, log);
+        break;
+    }
 }
 
-vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
-    vector<SlotCount> all;
+// Smallest slice worth handing to its own thread.
+const size_t kMinChunkBytes = 256 << 10;
 
-    for (size_t i = 0; i < idZone.size(); i++) {
-        for (int h = 0; h < 24; h++) {
-            if (zoneHour[i][h] > 0)
-                all.push_back({idZone[i], h, zoneHour[i][h]});
+// Splits [p, end) into up to `threads` newline-aligned chunks, aggregates
+// each on its own thread and folds the partial tables into t in file order.
+// Row logs are translated to t's ids and concatenated into log.
+void ingestParallel(const char* p, const char* end, Columns cols, unsigned threads,
+                    const EnginePlan& plan, ZoneTable& t, RowLog* log = nullptr) {
+    size_t n = min<size_t>(threads, (size_t)(end - p) / kMinChunkBytes);
+    if (n <= 1) {
+        ingestPlanned(plan, p, end, cols, t, log);
+        return;
+    }
+
+    vector<const char*> cut(n + 1);
+    cut[0] = p;
+    cut[n] = end;
+    for (size_t i = 1; i < n; i++) {
+        const char* c = max(cut[i - 1], p + (end - p) * i / n);
+        const char* nl = static_cast<const char*>(memchr(c, '\n', end - c));
+        cut[i] = nl ? nl + 1 : end;
+    }
+
+    vector<ZoneTable> parts(n);
+    vector<RowLog> logs(log ? n : 0);
+    auto work = [&](size_t i) {
+        ingestPlanned(plan, cut[i], cut[i + 1], cols, parts[i], log ? &logs[i] : nullptr);
+    };
+    vector<thread> workers;
+    for (size_t i = 1; i < n; i++) workers.emplace_back(work, i);
+    work(0);
+    for (auto& w : workers) w.join();
+
+    t = move(parts[0]);
+    for (size_t i = 1; i < n; i++) t.mergeFrom(parts[i]);
+    if (!log) return;
+
+    for (size_t i = 0; i < n; i++) {
+        vector<uint32_t> remap(parts[i].zones.size());
+        for (size_t z = 0; z < remap.size(); z++)
+            remap[z] = t.zones.find(parts[i].zones.key((uint32_t)z));
+        for (uint32_t z : logs[i].zone) log->zone.push_back(remap[z]);
+        log->hour.insert(log->hour.end(), logs[i].hour.begin(), logs[i].hour.end());
+    }
+}
+
+// Incremental ingest of one CSV stream that arrives in pieces. The first
+// complete line fixes the column layout (see readHeader); rows split across
+// pieces are carried over until their newline arrives.
+struct LineStream {
+    bool haveHeader = false;
+    Columns cols;
+    string carry;   // start of a line whose newline has not arrived yet
+
+    // Ingests [p, end), which must hold complete lines only.
+    void lines(const char* p, const char* end, const string& zoneName,
+               const string& timeName, ZoneTable& t) {
+        if (p == end) return;
+        if (!haveHeader) {
+            p = readHeader(p, end, zoneName, timeName, cols);
+            haveHeader = true;
+        }
+        ingestLines(p, end, cols, t);
+    }
+
+    // Ingests the complete lines of carry + [p, end) and keeps the rest.
+    void feed(const char* p, const char* end, const string& zoneName,
+              const string& timeName, ZoneTable& t) {
+        if (!carry.empty()) {
+            const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+            if (!nl) {
+                carry.append(p, end);
+                return;
+            }
+            carry.append(p, nl + 1);
+            lines(carry.data(), carry.data() + carry.size(), zoneName, timeName, t);
+            carry.clear();
+            p = nl + 1;
+        }
+
+        const char* last = end;
+        while (last > p && last[-1] != '\n') last--;
+        lines(p, last, zoneName, timeName, t);
+        carry.assign(last, end);
+    }
+
+    // Ingests a final line that never got its newline and resets the stream.
+    void finish(const string& zoneName, const string& timeName, ZoneTable& t) {
+        carry += '\n';
+        if (carry.size() > 1) lines(carry.data(), carry.data() + carry.size(), zoneName, timeName, t);
+        *this = LineStream();
+    }
+};
+
+// ---------------- pipelined ingest ----------------
+
+// One block of the input, cut at a line boundary, and the rows the parser
+// found in it. The rows point into `bytes`.
+struct PipeBlock {
+    vector<char> bytes;
+    size_t len = 0;
+    vector<pair<string_view, uint8_t>> rows;
+};
+
+const size_t kPipeBlockBytes = 4 << 20;
+const size_t kPipeBlocks = 4;
+
+using PipeClock = chrono::steady_clock;
+
+double msSince(PipeClock::time_point t0) {
+    return chrono::duration<double, milli>(PipeClock::now() - t0).count();
+}
+
+// Where a stage with nothing to do sleeps until the other end of its
+// queue moves. The side that moves looks for a sleeper after its lock-free
+// push or pop and only then takes the mutex, so a busy pipeline never
+// touches it. The fences order "I am going to sleep" against the queue
+// index on both sides, so a wake-up cannot slip between the sleeper's last
+// look at the queue and its wait.
+struct Parking {
+    mutex m;
+    condition_variable cv;
+    atomic<int> sleepers{0};
+
+    // Blocks until ready() returns true; ready() is re-run after each wake.
+    template <class F>
+    void waitFor(F ready) {
+        unique_lock<mutex> lock(m);
+        sleepers.fetch_add(1);
+        atomic_thread_fence(memory_order_seq_cst);
+        cv.wait(lock, ready);
+        sleepers.fetch_sub(1);
+    }
+
+    void wake() {
+        atomic_thread_fence(memory_order_seq_cst);
+        if (sleepers.load(memory_order_relaxed) == 0) return;
+        lock_guard<mutex> lock(m);
+        cv.notify_one();
+    }
+};
+
+// An SpscQueue whose ends can block: the consumer parks while it is empty
+// and the producer while it is full.
+template <class T>
+struct PipeQueue {
+    explicit PipeQueue(size_t capacity) : ring(capacity) {}
+
+    SpscQueue<T> ring;
+    Parking notEmpty, notFull;
+};
+
+// Tries on a queue before parking: a hand-off between two running stages
+// lands within a few hundred nanoseconds, so it is not worth a sleep.
+const int kPipeSpins = 64;
+
+// Blocking ends of a PipeQueue. Time spent waiting on the other stage is
+// added to `waitMs`.
+template <class T>
+void pushWait(PipeQueue<T>& q, T v, double& waitMs) {
+    if (!q.ring.tryPush(v)) {
+        auto t0 = PipeClock::now();
+        bool done = false;
+        for (int spins = 0; spins < kPipeSpins && !done; spins++) done = q.ring.tryPush(v);
+        if (!done) q.notFull.waitFor([&] { return q.ring.tryPush(v); });
+        waitMs += msSince(t0);
+    }
+    q.notEmpty.wake();
+}
+
+template <class T>
+T popWait(PipeQueue<T>& q, double& waitMs) {
+    T v;
+    if (!q.ring.tryPop(v)) {
+        auto t0 = PipeClock::now();
+        bool done = false;
+        for (int spins = 0; spins < kPipeSpins && !done; spins++) done = q.ring.tryPop(v);
+        if (!done) q.notEmpty.waitFor([&] { return q.ring.tryPop(v); });
+        waitMs += msSince(t0);
+    }
+    q.notFull.wake();
+    return v;
+}
+
+// Ingests `file` with reading, parsing and counting on three threads, so
+// the disk, the parser and the table updates overlap. Blocks travel
+// reader -> parser -> aggregator -> back to the reader; with a fixed
+// number of blocks in circulation, the slowest stage throttles the others.
+// A null block marks the end of the input.
+void ingestPipelined(InputFile& file, const string& zoneName, const string& timeName,
+                     ZoneTable& t, RowLog* log, IngestStats& stats) {
+    auto start = PipeClock::now();
+    vector<PipeBlock> blocks(kPipeBlocks);
+    PipeQueue<PipeBlock*> toParse(kPipeBlocks + 1), toCount(kPipeBlocks + 1), toRead(kPipeBlocks + 1);
+    for (PipeBlock& b : blocks) toRead.ring.tryPush(&b);
+
+    // Fills blocks from the file. A block ends after its last newline; the
+    // partial line behind it starts the next block.
+    thread reader([&] {
+        string carry;
+        bool eof = false;
+        while (!eof) {
+            PipeBlock* b = popWait(toRead, stats.readWaitMs);
+            auto t0 = PipeClock::now();
+            if (b->bytes.size() < carry.size() + kPipeBlockBytes)
+                b->bytes.resize(carry.size() + kPipeBlockBytes);
+            memcpy(b->bytes.data(), carry.data(), carry.size());
+            size_t used = carry.size();
+
+            size_t cut = 0;
+            for (;;) {
+                size_t n = file.readSome(b->bytes.data() + used, b->bytes.size() - used);
+                used += n;
+                if (n == 0) {
+                    eof = true;
+                    cut = used;
+                    break;
+                }
+                if (used < b->bytes.size()) continue;
+
+                const char* nl = static_cast<const char*>(memrchr(b->bytes.data(), '\n', used));
+                if (nl) {
+                    cut = (size_t)(nl - b->bytes.data()) + 1;
+                    break;
+                }
+                b->bytes.resize(b->bytes.size() * 2);   // a line longer than a block
+            }
+            b->len = cut;
+            carry.assign(b->bytes.data() + cut, used - cut);
+            stats.bytes += cut;
+            stats.readMs += msSince(t0);
+            pushWait(toParse, b, stats.readWaitMs);
+        }
+        pushWait(toParse, (PipeBlock*)nullptr, stats.readWaitMs);
+    });
+
+    // Splits blocks into (zone, hour) rows; the first line is the header.
+    thread parser([&] {
+        Columns cols;
+        bool haveHeader = false;
+        while (PipeBlock* b = popWait(toParse, stats.parseWaitMs)) {
+            auto t0 = PipeClock::now();
+            const char* p = b->bytes.data();
+            const char* end = p + b->len;
+            if (!haveHeader && p != end) {
+                p = readHeader(p, end, zoneName, timeName, cols);
+                haveHeader = true;
+            }
+            b->rows.clear();
+            forEachRow(p, end, cols, [b](string_view zone, int hour) {
+                b->rows.emplace_back(zone, (uint8_t)hour);
+            });
+            stats.parseMs += msSince(t0);
+            pushWait(toCount, b, stats.parseWaitMs);
+        }
+        pushWait(toCount, (PipeBlock*)nullptr, stats.parseWaitMs);
+    });
+
+    // Counts on the calling thread, which owns the table.
+    while (PipeBlock* b = popWait(toCount, stats.aggregateWaitMs)) {
+        auto t0 = PipeClock::now();
+        BatchCounter rows(t, log);
+        for (auto& [zone, hour] : b->rows) rows.add(zone, hour);
+        rows.finish();
+        stats.rows += b->rows.size();
+        stats.aggregateMs += msSince(t0);
+        pushWait(toRead, b, stats.aggregateWaitMs);
+    }
+
+    reader.join();
+    parser.join();
+    stats.totalMs += msSince(start);
+}
+
+// Stage times of several ingests, summed.
+void addStats(IngestStats& a, const IngestStats& b) {
+    a.readMs += b.readMs;
+    a.readWaitMs += b.readWaitMs;
+    a.parseMs += b.parseMs;
+    a.parseWaitMs += b.parseWaitMs;
+    a.aggregateMs += b.aggregateMs;
+    a.aggregateWaitMs += b.aggregateWaitMs;
+    a.totalMs += b.totalMs;
+    a.bytes += b.bytes;
+    a.rows += b.rows;
+    if (a.engine == AggregationEngine::Auto) a.engine = b.engine;
+    a.estimatedZones += b.estimatedZones;
+}
+
+// ---------------- sidecar cache ----------------
+//
+// <csv>.tacache holds the result of parsing <csv>: the zone dictionary and
+// one entry per accepted row (zone id, hour) in file order. The zone column
+// is stored 1, 2 or 4 bytes wide depending on the number of zones. The
+// header pins the source's size, mtime and a checksum of its first and last
+// 64 KiB together with the column names the rows were read with; any
+// mismatch makes the sidecar stale. Integers are in host byte order.
+
+const char kSidecarMagic[8] = {'T', 'A', 'C', 'A', 'C', 'H', 'E', '\0'};
+const uint32_t kSidecarVersion = 2;
+const size_t kSidecarSampleBytes = 64 << 10;
+
+struct SidecarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t zoneWidth;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceChecksum;
+    uint64_t columnsHash;
+    uint64_t zoneCount;
+    uint64_t arenaBytes;
+    uint64_t rowCount;
+};
+
+uint64_t sourceChecksum(const InputFile& f) {
+    size_t n = min(f.size(), kSidecarSampleBytes);
+    uint64_t head = ZoneDict::hash(string_view(f.data(), n));
+    uint64_t tail = ZoneDict::hash(string_view(f.data() + f.size() - n, n));
+    return head ^ (tail * 0x9E3779B97F4A7C15ULL);
+}
+
+uint64_t columnsHash(const string& zoneColumn, const string& timeColumn) {
+    return ZoneDict::hash(zoneColumn + ',' + timeColumn);
+}
+
+SidecarHeader sidecarHeaderFor(const InputFile& src, uint64_t colHash) {
+    SidecarHeader h = {};
+    memcpy(h.magic, kSidecarMagic, sizeof h.magic);
+    h.version = kSidecarVersion;
+    h.sourceSize = src.size();
+    h.sourceMtime = src.mtime();
+    h.sourceChecksum = sourceChecksum(src);
+    h.columnsHash = colHash;
+    return h;
+}
+
+uint32_t zoneWidthFor(size_t zones) {
+    return zones <= 0x100 ? 1 : zones <= 0x10000 ? 2 : 4;
+}
+
+// False, with some rows already counted, at the first zone id that is not
+// below zones.
+template <class Int>
+bool countRows(const char* zone, const uint8_t* hour, size_t rows, uint64_t zones, ZoneTable& t) {
+    for (size_t r = 0; r < rows; r++) {
+        Int id;
+        memcpy(&id, zone + r * sizeof(Int), sizeof(Int));
+        if (id >= zones) return false;
+        t.count((int)id, hour[r]);
+    }
+    return true;
+}
+
+// Loads t from the sidecar at path if it was written for src with the
+// same columns. Leaves t empty and returns false otherwise.
+bool loadSidecar(const string& path, const InputFile& src, uint64_t colHash, ZoneTable& t) {
+    InputFile f(path);
+    if (!f.ok() || f.size() < sizeof(SidecarHeader)) return false;
+
+    SidecarHeader h;
+    memcpy(&h, f.data(), sizeof h);
+    SidecarHeader want = sidecarHeaderFor(src, colHash);
+    if (memcmp(h.magic, want.magic, sizeof h.magic) != 0 || h.version != want.version ||
+        h.sourceSize != want.sourceSize || h.sourceMtime != want.sourceMtime ||
+        h.sourceChecksum != want.sourceChecksum || h.columnsHash != want.columnsHash ||
+        h.zoneWidth != zoneWidthFor(h.zoneCount))
+        return false;
+    // Bound the counts before sizing anything from them, so a corrupt
+    // header cannot overflow `need` or ask reserve() for the impossible.
+    const uint64_t limit = (uint64_t)1 << 32;
+    if (h.zoneCount >= limit || h.arenaBytes >= limit || h.rowCount > f.size() / (h.zoneWidth + 1))
+        return false;
+
+    size_t offsetsBytes = (h.zoneCount + 1) * sizeof(uint32_t);
+    size_t need = sizeof h + offsetsBytes + h.arenaBytes + h.rowCount * (h.zoneWidth + 1);
+    if (f.size() != need) return false;
+
+    const char* p = f.data() + sizeof h;
+    const char* arena = p + offsetsBytes;
+    t.reserve(h.zoneCount, h.arenaBytes);
+    for (uint64_t z = 0; z < h.zoneCount; z++) {
+        uint32_t b, e;
+        memcpy(&b, p + z * 4, 4);
+        memcpy(&e, p + z * 4 + 4, 4);
+        if (b > e || e > h.arenaBytes || t.idFor(string_view(arena + b, e - b)) != (int)z) {
+            t.clear();
+            return false;
         }
     }
 
-    sort(all.begin(), all.end(), [](const SlotCount& a, const SlotCount& b) {
+    const char* zone = arena + h.arenaBytes;
+    const uint8_t* hour = reinterpret_cast<const uint8_t*>(zone + h.rowCount * h.zoneWidth);
+    for (uint64_t r = 0; r < h.rowCount; r++) {
+        if (hour[r] > 23) { t.clear(); return false; }
+    }
+    bool ok;
+    if (h.zoneWidth == 1) ok = countRows<uint8_t>(zone, hour, h.rowCount, h.zoneCount, t);
+    else if (h.zoneWidth == 2) ok = countRows<uint16_t>(zone, hour, h.rowCount, h.zoneCount, t);
+    else ok = countRows<uint32_t>(zone, hour, h.rowCount, h.zoneCount, t);
+    if (!ok) t.clear();
+    return ok;
+}
+
+template <class Int>
+bool writeZoneColumn(FILE* out, const vector<uint32_t>& ids) {
+    if (ids.empty()) return true;
+    vector<Int> col(ids.begin(), ids.end());
+    return fwrite(col.data(), sizeof(Int), col.size(), out) == col.size();
+}
+
+// Writes path by filling a temporary file next to it and renaming it into
+// place, so readers never see a partial file. Returns false, leaving path
+// untouched, if anything fails.
+bool writeFileAtomically(const string& path, const function<bool(FILE*)>& fill) {
+    // Unique per call, so threads writing the same path never share a
+    // temporary file.
+    static atomic<unsigned> calls{0};
+    string tmp = path + ".tmp" + to_string(getpid()) + "." + to_string(calls++);
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out) return false;
+    bool ok = fill(out);
+    ok = fclose(out) == 0 && ok;
+    if (ok && rename(tmp.c_str(), path.c_str()) == 0) return true;
+    remove(tmp.c_str());
+    return false;
+}
+
+template <class T>
+bool writeArray(FILE* out, const T* data, size_t n) {
+    if (n == 0) return true;   // data may be null
+    return fwrite(data, sizeof(T), n, out) == n;
+}
+
+// Writes the sidecar for src next to it. Failures (e.g. a read-only
+// directory) are ignored: the next ingest simply parses the CSV again.
+void writeSidecar(const string& path, const InputFile& src, uint64_t colHash,
+                  const ZoneTable& t, const RowLog& log) {
+    SidecarHeader h = sidecarHeaderFor(src, colHash);
+    h.zoneCount = t.zones.size();
+    h.zoneWidth = zoneWidthFor(h.zoneCount);
+    h.rowCount = log.zone.size();
+    h.arenaBytes = t.zones.rawArena().size();
+
+    writeFileAtomically(path, [&](FILE* out) {
+        const auto& offsets = t.zones.rawOffsets();
+        string_view arena = t.zones.rawArena();
+        bool ok = writeArray(out, &h, 1) && writeArray(out, offsets.data(), offsets.size()) &&
+                  writeArray(out, arena.data(), arena.size());
+        if (!ok) return false;
+        if (h.zoneWidth == 1) ok = writeZoneColumn<uint8_t>(out, log.zone);
+        else if (h.zoneWidth == 2) ok = writeZoneColumn<uint16_t>(out, log.zone);
+        else ok = writeZoneColumn<uint32_t>(out, log.zone);
+        return ok && writeArray(out, log.hour.data(), log.hour.size());
+    });
+}
+
+// ---------------- snapshots ----------------
+//
+// A snapshot is the aggregate state laid out for mapping: a fixed header,
+// then the dictionary's slots, key offsets and key bytes, then zoneTotal
+// and zoneHour. Every section starts on an 8-byte boundary. Loading maps
+// the file and copies each section in one go, so the hash table is adopted
+// as-is instead of being rebuilt key by key. Integers are in host byte
+// order, and the header's byte-order mark rejects files from other hosts.
+
+const char kSnapshotMagic[8] = {'T', 'A', 'S', 'N', 'A', 'P', '\0', '\0'};
+const uint32_t kSnapshotVersion = 1;
+const uint32_t kByteOrderMark = 0x01020304;
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t zoneCount;
+    uint64_t slotCount;
+    uint64_t arenaBytes;
+};
+
+size_t align8(size_t n) { return (n + 7) & ~(size_t)7; }
+
+// Byte offset of each section, and the total file size.
+struct SnapshotLayout {
+    size_t slots, offsets, arena, totals, hours, size;
+
+    explicit SnapshotLayout(const SnapshotHeader& h) {
+        slots   = align8(sizeof h);
+        offsets = align8(slots + h.slotCount * sizeof(ZoneDict::Slot));
+        arena   = align8(offsets + (h.zoneCount + 1) * sizeof(uint32_t));
+        totals  = align8(arena + h.arenaBytes);
+        hours   = totals + h.zoneCount * sizeof(long long);
+        size    = hours + h.zoneCount * sizeof(array<long long, 24>);
+    }
+};
+
+bool writePadding(FILE* out, size_t from, size_t to) {
+    static const char zeros[8] = {};
+    return writeArray(out, zeros, to - from);
+}
+
+bool writeSnapshot(const string& path, const ZoneTable& t) {
+    const auto& slots = t.zones.rawSlots();
+    const auto& offsets = t.zones.rawOffsets();
+    string_view arena = t.zones.rawArena();
+
+    SnapshotHeader h = {};
+    memcpy(h.magic, kSnapshotMagic, sizeof h.magic);
+    h.version = kSnapshotVersion;
+    h.byteOrder = kByteOrderMark;
+    h.zoneCount = t.zones.size();
+    h.slotCount = slots.size();
+    h.arenaBytes = arena.size();
+    SnapshotLayout at(h);
+
+    return writeFileAtomically(path, [&](FILE* out) {
+        return writeArray(out, &h, 1) && writePadding(out, sizeof h, at.slots) &&
+               writeArray(out, slots.data(), slots.size()) &&
+               writeArray(out, offsets.data(), offsets.size()) &&
+               writePadding(out, at.offsets + offsets.size() * sizeof(uint32_t), at.arena) &&
+               writeArray(out, arena.data(), arena.size()) &&
+               writePadding(out, at.arena + arena.size(), at.totals) &&
+               writeArray(out, t.zoneTotal.data(), t.zoneTotal.size()) &&
+               writeArray(out, t.zoneHour.data(), t.zoneHour.size());
+    });
+}
+
+// Fills t (which must be empty) from a snapshot. Returns false if the file
+// is missing, truncated, from another version or byte order, or internally
+// inconsistent.
+bool readSnapshot(const string& path, ZoneTable& t) {
+    InputFile f(path);
+    if (!f.ok() || f.size() < sizeof(SnapshotHeader)) return false;
+
+    SnapshotHeader h;
+    memcpy(&h, f.data(), sizeof h);
+    const uint64_t limit = (uint64_t)1 << 32;
+    if (memcmp(h.magic, kSnapshotMagic, sizeof h.magic) != 0 || h.version != kSnapshotVersion ||
+        h.byteOrder != kByteOrderMark || h.zoneCount >= limit || h.slotCount > limit ||
+        h.arenaBytes >= limit)
+        return false;
+
+    SnapshotLayout at(h);
+    if (f.size() != at.size) return false;
+
+    const char* base = f.data();
+    const auto* slots = reinterpret_cast<const ZoneDict::Slot*>(base + at.slots);
+    const auto* offsets = reinterpret_cast<const uint32_t*>(base + at.offsets);
+    if (!t.zones.restore(slots, h.slotCount, offsets, h.zoneCount,
+                         string_view(base + at.arena, h.arenaBytes)))
+        return false;
+
+    const auto* totals = reinterpret_cast<const long long*>(base + at.totals);
+    const auto* hours = reinterpret_cast<const array<long long, 24>*>(base + at.hours);
+    t.zoneTotal.assign(totals, totals + h.zoneCount);
+    t.zoneHour.assign(hours, hours + h.zoneCount);
+    return true;
+}
+
+// ---------------- rankings ----------------
+
+// Ranks zone ids by count desc, then name asc, and only materializes the
+// names of the k winners.
+vector<ZoneCount> rankZones(const ZoneTable& t, int k) {
+    if (k <= 0) return {};
+
+    auto best = makeTopK<uint32_t>((size_t)k, [&t](uint32_t a, uint32_t b) {
+        if (t.zoneTotal[a] != t.zoneTotal[b]) return t.zoneTotal[a] > t.zoneTotal[b];
+        return t.zones.key(a) < t.zones.key(b);
+    });
+    for (size_t i = 0; i < t.zones.size(); i++) best.push((uint32_t)i);
+
+    vector<ZoneCount> out;
+    for (uint32_t id : best.take())
+        out.push_back({string(t.zones.key(id)), t.zoneTotal[id]});
+    return out;
+}
+
+// Streams every non-empty (zone, hour) cell through a bounded heap, ranked
+// by count desc, name asc, hour asc; names are copied for the winners only.
+vector<SlotCount> rankSlots(const ZoneTable& t, int k) {
+    if (k <= 0) return {};
+
+    struct Cell {
+        long long count;
+        uint32_t id;
+        int hour;
+    };
+    auto best = makeTopK<Cell>((size_t)k, [&t](const Cell& a, const Cell& b) {
         if (a.count != b.count) return a.count > b.count;
-        if (a.zone != b.zone) return a.zone < b.zone;
+        if (a.id != b.id) return t.zones.key(a.id) < t.zones.key(b.id);
         return a.hour < b.hour;
     });
+    for (size_t i = 0; i < t.zones.size(); i++) {
+        for (int h = 0; h < 24; h++) {
+            if (t.zoneHour[i][h] > 0)
+                best.push({t.zoneHour[i][h], (uint32_t)i, h});
+        }
+    }
+
+    vector<SlotCount> out;
+    for (const Cell& c : best.take())
+        out.push_back({string(t.zones.key(c.id)), c.hour, c.count});
+    return out;
+}
 
-    if ((int)all.size() > k) all.resize(k);
-    return all;
+// The longest ranking computed since the state last changed. A request
+// for k results is answered from it whenever it was computed for at least
+// k; rankings are a prefix of any longer ranking.
+template <class T>
+struct RankingCache {
+    vector<T> items;
+    int k = -1;   // -1 means stale
+
+    bool covers(int want) const { return k >= want; }
+
+    vector<T> prefix(int want) const {
+        return vector<T>(items.begin(), items.begin() + min<size_t>(max(want, 0), items.size()));
+    }
+};
+
+}
+
+// Everything one analyzer owns. Nothing is shared between instances, so
+// separate analyzers can ingest and answer queries on separate threads.
+struct TripAnalyzer::Impl {
+    ZoneTable table;
+    unsigned threads = 1;
+    string zoneColumn = "PickupZoneID";
+    string timeColumn = "PickupTime";
+    bool sidecar = false;
+    bool pipeline = false;
+    AggregationEngine engine = AggregationEngine::Auto;
+    IngestStats stats;
+
+    // Tail-follow position: bytes of the followed file already consumed
+    // (always a line boundary) and the stream's header state.
+    struct Follow {
+        string path;
+        uint64_t inode = 0;
+        size_t offset = 0;
+        LineStream stream;
+    } tail;
+
+    // Stream being assembled by pushChunk().
+    LineStream pushed;
+
+    // Rankings are cached between queries and dropped lazily: a change to
+    // the table only marks them stale. The lock keeps concurrent const
+    // queries on one analyzer safe.
+    mutable mutex rankLock;
+    mutable RankingCache<ZoneCount> zoneRanks;
+    mutable RankingCache<SlotCount> slotRanks;
+
+    void changed() {
+        lock_guard<mutex> g(rankLock);
+        zoneRanks.k = slotRanks.k = -1;
+    }
+
+    // Aggregates one CSV file (or its sidecar) into table, splitting it
+    // across up to `threads` threads. Pipelined ingests add to *stats.
+    void readCsvFile(const string& csvPath, ZoneTable& table, unsigned threads,
+                     IngestStats* stats) const;
+
+    // Aggregates a pipe, FIFO or stdin as it arrives, without buffering
+    // the whole stream.
+    void readCsvStream(InputFile& file, ZoneTable& table) const;
+
+    // Aggregates gzip-compressed CSV, parsing each block while the
+    // reader's thread inflates the next.
+    void readGzip(GzipReader& gz, ZoneTable& table) const;
+
+    // Aggregates a complete CSV text, header included, into table.
+    // The aggregation engine comes from a sample of the rows unless one
+    // was forced with setEngine, in which case nothing is sampled; the
+    // choice is recorded in *stats.
+    void readCsv(const char* p, const char* end, ZoneTable& table, unsigned threads,
+                 IngestStats* stats, RowLog* log = nullptr) const {
+        Columns cols;
+        p = readHeader(p, end, zoneColumn, timeColumn, cols);
+        EnginePlan plan;
+        if (engine == AggregationEngine::Auto) plan = planEngine(p, end, cols);
+        else plan.engine = engine;
+        if (stats) {
+            stats->engine = plan.engine;
+            stats->estimatedZones = plan.estimatedZones;
+        }
+        ingestParallel(p, end, cols, threads, plan, table, log);
+    }
+
+    void absorb(ZoneTable&& table, IngestMode mode) {
+        if (mode == IngestMode::Replace) this->table = move(table);
+        else this->table.mergeFrom(table);
+        changed();
+    }
+};
+
+TripAnalyzer::TripAnalyzer() : impl(make_unique<Impl>()) {}
+TripAnalyzer::~TripAnalyzer() = default;
+
+// A moved-from analyzer is left empty and usable, as a new one would be.
+TripAnalyzer::TripAnalyzer(TripAnalyzer&& other) noexcept
+    : impl(move(other.impl)) {
+    other.impl = make_unique<Impl>();
+}
+
+TripAnalyzer& TripAnalyzer::operator=(TripAnalyzer&& other) noexcept {
+    if (&other != this) {
+        impl = move(other.impl);
+        other.impl = make_unique<Impl>();
+    }
+    return *this;
+}
+
+void TripAnalyzer::setThreads(unsigned n) {
+    impl->threads = n ? n : max(1u, thread::hardware_concurrency());
+}
+
+void TripAnalyzer::setColumns(const string& zoneColumn, const string& timeColumn) {
+    impl->zoneColumn = zoneColumn;
+    impl->timeColumn = timeColumn;
+}
+
+void TripAnalyzer::setSidecarCache(bool enabled) {
+    impl->sidecar = enabled;
+}
+
+void TripAnalyzer::setPipeline(bool enabled) {
+    impl->pipeline = enabled;
+}
+
+void TripAnalyzer::setEngine(AggregationEngine engine) {
+    impl->engine = engine;
+}
+
+IngestStats TripAnalyzer::ingestStats() const {
+    return impl->stats;
+}
+
+void TripAnalyzer::ingestFile(const string& csvPath) {
+    ingestFile(csvPath, IngestMode::Replace);
+}
+
+// The file is always aggregated into a table of its own, which then either
+// replaces the current state or is merged into it. That keeps the sidecar
+// cache in terms of the file's own zone ids in both modes.
+void TripAnalyzer::ingestFile(const string& csvPath, IngestMode mode) {
+    ZoneTable table;
+    impl->stats = IngestStats();
+    impl->readCsvFile(csvPath, table, impl->threads, &impl->stats);
+    impl->absorb(move(table), mode);
+}
+
+// Files are handed out one at a time from a shared counter, so a few large
+// files do not leave the other workers idle. Each worker sums its files into
+// its own table; the tables are merged in worker order at the end. Rankings
+// depend only on the summed counts (ties break by zone name), so the result
+// does not depend on which worker happened to get which file.
+void TripAnalyzer::ingestFiles(const vector<string>& csvPaths, IngestMode mode) {
+    size_t workers = min<size_t>(impl->threads, csvPaths.size());
+    // Threads left over when there are fewer files than threads split files.
+    unsigned perFile = max(1u, impl->threads / (unsigned)max<size_t>(workers, 1));
+
+    vector<ZoneTable> parts(max<size_t>(workers, 1));
+    vector<IngestStats> stats(parts.size());
+    atomic<size_t> nextFile{0};
+    auto work = [&](size_t w) {
+        for (size_t i; (i = nextFile++) < csvPaths.size();) {
+            ZoneTable file;
+            impl->readCsvFile(csvPaths[i], file, perFile, &stats[w]);
+            if (parts[w].zones.size() == 0) parts[w] = move(file);
+            else parts[w].mergeFrom(file);
+        }
+    };
+    vector<thread> pool;
+    for (size_t w = 1; w < workers; w++) pool.emplace_back(work, w);
+    work(0);
+    for (auto& t : pool) t.join();
+
+    for (size_t w = 1; w < parts.size(); w++) {
+        parts[0].mergeFrom(parts[w]);
+        addStats(stats[0], stats[w]);
+    }
+    impl->stats = stats[0];
+    impl->absorb(move(parts[0]), mode);
+}
+
+void TripAnalyzer::ingestBuffer(const char* data, size_t len, IngestMode mode) {
+    ZoneTable table;
+    impl->stats = IngestStats();
+    impl->readCsv(data, data + len, table, impl->threads, &impl->stats);
+    impl->absorb(move(table), mode);
+}
+
+void TripAnalyzer::pushChunk(const char* data, size_t len) {
+    impl->pushed.feed(data, data + len, impl->zoneColumn, impl->timeColumn, impl->table);
+    impl->changed();
+}
+
+void TripAnalyzer::finishChunks() {
+    impl->pushed.finish(impl->zoneColumn, impl->timeColumn, impl->table);
+    impl->changed();
+}
+
+void TripAnalyzer::Impl::readCsvFile(const string& csvPath, ZoneTable& table,
+                                     unsigned threads, IngestStats* stats) const {
+    InputFile file(csvPath);
+    if (!file.ok()) return;
+    if (!file.isRegular()) {
+        readCsvStream(file, table);
+        return;
+    }
+
+    const char* p = file.data();
+    const char* end = p + file.size();
+    if (isGzip(p, file.size())) {
+        GzipReader gz(p, file.size());
+        readGzip(gz, table);
+        return;
+    }
+
+    bool cache = sidecar && file.isRegular();
+    string cachePath = csvPath + ".tacache";
+    uint64_t colHash = columnsHash(zoneColumn, timeColumn);
+    if (cache && loadSidecar(cachePath, file, colHash, table)) return;
+
+    RowLog log;
+    if (pipeline) {
+        IngestStats unused;
+        ingestPipelined(file, zoneColumn, timeColumn, table, cache ? &log : nullptr,
+                        stats ? *stats : unused);
+    } else {
+        readCsv(p, end, table, threads, stats, cache ? &log : nullptr);
+    }
+    if (cache) writeSidecar(cachePath, file, colHash, table, log);
+}
+
+// Parses the stream a block at a time; only the partial row at the end of
+// each block is copied.
+void TripAnalyzer::Impl::readCsvStream(InputFile& file, ZoneTable& table) const {
+    const size_t blockBytes = 4 << 20;
+    unique_ptr<char[]> block(new char[blockBytes]);
+    LineStream stream;
+    bool more = true;
+    bool first = true;
+    while (more) {
+        // A pipe hands over at most its buffer size per read; fill the
+        // block before parsing it.
+        size_t used = 0;
+        while (used < blockBytes) {
+            size_t n = file.readSome(block.get() + used, blockBytes - used);
+            if (n == 0) { more = false; break; }
+            used += n;
+        }
+        if (first && isGzip(block.get(), used)) {
+            GzipReader gz(block.get(), used,
+                          [&](char* dst, size_t n) { return file.readSome(dst, n); });
+            readGzip(gz, table);
+            return;
+        }
+        first = false;
+        stream.feed(block.get(), block.get() + used, zoneColumn, timeColumn, table);
+    }
+    stream.finish(zoneColumn, timeColumn, table);
+}
+
+void TripAnalyzer::Impl::readGzip(GzipReader& gz, ZoneTable& table) const {
+    LineStream stream;
+    vector<char> block;
+    while (gz.next(block))
+        stream.feed(block.data(), block.data() + block.size(), zoneColumn, timeColumn, table);
+    stream.finish(zoneColumn, timeColumn, table);
+    // A truncated or corrupt archive counts as unreadable, like a missing
+    // file, rather than as whatever prefix happened to decompress.
+    if (!gz.ok()) table.clear();
+}
+
+void TripAnalyzer::follow(const string& csvPath) {
+    impl->table.clear();
+    impl->tail = Impl::Follow();
+    impl->tail.path = csvPath;
+    impl->changed();
+}
+
+size_t TripAnalyzer::poll() {
+    Impl::Follow& f = impl->tail;
+    InputFile file(f.path);
+    if (!file.ok() || !file.isRegular()) return 0;
+
+    // Truncated or replaced (e.g. rotated): start over.
+    if (file.size() < f.offset || (f.offset > 0 && file.inode() != f.inode)) {
+        string path = f.path;   // follow() resets f, path included
+        follow(path);
+    }
+    f.inode = file.inode();
+
+    const char* p = file.data() + f.offset;
+    const char* end = file.data() + file.size();
+    while (end > p && end[-1] != '\n') end--;   // hold back a partial last line
+    if (p == end) return 0;
+
+    f.stream.lines(p, end, impl->zoneColumn, impl->timeColumn, impl->table);
+    f.offset += (size_t)(end - p);
+    impl->changed();
+    return (size_t)(end - p);
+}
+
+void TripAnalyzer::merge(const TripAnalyzer& other) {
+    impl->table.mergeFrom(other.impl->table);
+    impl->changed();
+}
+
+// Folds the smaller table into the larger one, so the cost is linear in
+// the smaller side whichever analyzer it belongs to.
+void TripAnalyzer::merge(TripAnalyzer&& other) {
+    if (&other == this) return;
+    ZoneTable& mine = impl->table;
+    ZoneTable& theirs = other.impl->table;
+    if (theirs.zones.size() > mine.zones.size()) swap(mine, theirs);
+    mine.mergeFrom(theirs);
+    theirs.clear();
+    impl->changed();
+    other.impl->changed();
+}
+
+bool TripAnalyzer::saveSnapshot(const string& path) const {
+    return writeSnapshot(path, impl->table);
+}
+
+bool TripAnalyzer::isSnapshot(const string& path) {
+    InputFile f(path);
+    return f.ok() && f.isRegular() && f.size() >= sizeof kSnapshotMagic &&
+           memcmp(f.data(), kSnapshotMagic, sizeof kSnapshotMagic) == 0;
+}
+
+bool TripAnalyzer::loadSnapshot(const string& path) {
+    ZoneTable loaded;
+    if (!readSnapshot(path, loaded)) return false;
+    impl->table = move(loaded);
+    impl->changed();
+    return true;
+}
+
+vector<ZoneCount> TripAnalyzer::topZones(int k) const {
+    lock_guard<mutex> g(impl->rankLock);
+    auto& cache = impl->zoneRanks;
+    if (!cache.covers(k)) {
+        cache.items = rankZones(impl->table, k);
+        cache.k = k;
+    }
+    return cache.prefix(k);
+}
+
+vector<SlotCount> TripAnalyzer::topBusySlots(int k) const {
+    lock_guard<mutex> g(impl->rankLock);
+    auto& cache = impl->slotRanks;
+    if (!cache.covers(k)) {
+        cache.items = rankSlots(impl->table, k);
+        cache.k = k;
+    }
+    return cache.prefix(k);
 }
@@ -1,6 +1,8 @@
 #ifndef ANALYZER_H
 #define ANALYZER_H
 
+#include <cstddef>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -15,11 +17,122 @@ struct SlotCount {
     long long count;
 };
 
+// How ingestFile treats the state left by earlier calls.
+enum class IngestMode {
+    Replace,   // start from an empty state (the default)
+    Append     // keep the existing counts and add the file's rows to them
+};
+
+// How rows are aggregated. Auto samples each file and picks one of the
+// others; the rest force a strategy for every file.
+enum class AggregationEngine {
+    Auto,
+    Tiny,    // a few zones: names compared in a small array, no hashing
+    Hash,    // the general zone dictionary
+    Radix    // very many zones: rows grouped by hash prefix before lookup
+};
+
+// Figures about the last ingest call. engine is the strategy used for the
+// in-place parse (Auto when the input went another way: pipelined,
+// compressed, streamed or reloaded from a sidecar). The per-stage times are
+// filled by pipelined ingests only (see setPipeline); each stage's time is
+// split into work and waiting on a neighbouring stage, and a stage that
+// rarely waits is the bottleneck.
+struct IngestStats {
+    AggregationEngine engine = AggregationEngine::Auto;
+    std::size_t estimatedZones = 0;   // distinct zones the sample predicted (0 if forced)
+    double readMs = 0, readWaitMs = 0;
+    double parseMs = 0, parseWaitMs = 0;
+    double aggregateMs = 0, aggregateWaitMs = 0;
+    double totalMs = 0;
+    std::size_t bytes = 0;
+    std::size_t rows = 0;
+};
+
 class TripAnalyzer {
 public:
+    TripAnalyzer();
+    ~TripAnalyzer();
+    // Moving leaves the source empty, with default settings, and usable.
+    TripAnalyzer(TripAnalyzer&&) noexcept;
+    TripAnalyzer& operator=(TripAnalyzer&&) noexcept;
+
     void ingestFile(const std::string& csvPath);
+    void ingestFile(const std::string& csvPath, IngestMode mode);
+
+    // Ingests several CSV files as one data set, spread over the threads
+    // set by setThreads (one file per thread at a time). The result is the
+    // same as ingesting the files one after another in Append mode.
+    void ingestFiles(const std::vector<std::string>& csvPaths,
+                     IngestMode mode = IngestMode::Replace);
+
+    // Ingests CSV text that is already in memory, header row included,
+    // exactly as ingestFile would a file with the same bytes.
+    void ingestBuffer(const char* data, std::size_t len, IngestMode mode = IngestMode::Replace);
+
+    // Push-style ingest of one CSV stream that arrives in pieces, added to
+    // the current state. The first line of the stream is its header, and
+    // rows may be split anywhere across chunks. finishChunks() ingests a
+    // final line that lacks a newline and ends the stream; the next push
+    // starts a new one.
+    void pushChunk(const char* data, std::size_t len);
+    void finishChunks();
     std::vector<ZoneCount> topZones(int k = 10) const;
     std::vector<SlotCount> topBusySlots(int k = 10) const;
+
+    // Worker threads ingestFile may split a file across; 0 means one per
+    // hardware thread. The default of 1 keeps ingest serial.
+    void setThreads(unsigned n);
+
+    // Header names of the pickup zone and pickup time columns, looked up in
+    // the first row of each file ("PickupZoneID" and "PickupTime" by
+    // default). Files without a header fall back to positional detection.
+    void setColumns(const std::string& zoneColumn, const std::string& timeColumn);
+
+    // When enabled, ingestFile keeps a binary sidecar (<csvPath>.tacache)
+    // of the parsed rows and reloads from it while the CSV is unchanged.
+    void setSidecarCache(bool enabled);
+
+    // When enabled, uncompressed files are ingested by a three-stage
+    // pipeline (read, parse, count) on three threads instead of being
+    // mapped and parsed in place. Worth it when the disk is slow enough to
+    // overlap with parsing. ingestStats() reports the per-stage times.
+    void setPipeline(bool enabled);
+    IngestStats ingestStats() const;
+
+    // Overrides the sampled choice of aggregation engine (Auto by default).
+    void setEngine(AggregationEngine engine);
+
+    // Persists the aggregate state to path in a versioned binary layout.
+    // Returns false if the file could not be written.
+    bool saveSnapshot(const std::string& path) const;
+
+    // Replaces the state with one written by saveSnapshot. Returns false,
+    // leaving the state untouched, if path is missing or not a valid
+    // snapshot.
+    bool loadSnapshot(const std::string& path);
+
+    // True if path starts like a snapshot, whether or not the rest of it
+    // is intact; tells snapshots from CSV input without trusting the name.
+    static bool isSnapshot(const std::string& path);
+
+    // Starts following a CSV file that keeps growing, from an empty state.
+    // Each poll() adds the complete lines appended since the previous poll;
+    // a partially written last line is held back until its newline lands.
+    // If the file shrinks or is replaced, it is re-read from the start.
+    // Returns the number of bytes consumed.
+    void follow(const std::string& csvPath);
+    std::size_t poll();
+
+    // Adds other's counts to this analyzer, as if its input had been
+    // ingested here too. The rvalue form may take over other's state and
+    // leaves other empty; moving an analyzer into itself changes nothing.
+    void merge(const TripAnalyzer& other);
+    void merge(TripAnalyzer&& other);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
 };
 
 #endif
@@ -0,0 +1,297 @@
+// Microbenchmarks for the analyzer's building blocks.
+//
+//   make bench
+//   ./bench dict [N ...]
+//   ./bench arena [N ...]
+//   ./bench topk [M ...]
+//   ./bench order [ZONES ...]
+//   ./bench unique [N ...]
+//
+// Memory figures come from counting live heap bytes through the global
+// operator new/delete below, so they include allocator slack.
+
+#include "analyzer.h"
+#include "topk.h"
+#include "zone_dict.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+#include <random>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+static size_t liveBytes = 0;
+
+void* operator new(size_t n) {
+    void* p = std::malloc(n ? n : 1);
+    if (!p) throw std::bad_alloc();
+    liveBytes += malloc_usable_size(p);
+    return p;
+}
+
+// GCC flags free() on memory from operator new, which is exactly the pairing
+// these replacements set up.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept {
+    if (!p) return;
+    liveBytes -= malloc_usable_size(p);
+    std::free(p);
+}
+#pragma GCC diagnostic pop
+
+void operator delete(void* p, size_t) noexcept { operator delete(p); }
+
+using Clock = std::chrono::steady_clock;
+
+static double nsSince(Clock::time_point t0, size_t ops) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - t0).count() / (double)ops;
+}
+
+// Keys shaped like the C1 generator: "Z" + zero-padded index.
+static std::vector<std::string> zoneKeys(size_t n) {
+    std::vector<std::string> keys(n);
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        std::snprintf(buf, sizeof buf, "Z%07zu", i);
+        keys[i] = buf;
+    }
+    return keys;
+}
+
+static std::vector<uint32_t> shuffledOrder(size_t n) {
+    std::vector<uint32_t> order(n);
+    for (size_t i = 0; i < n; i++) order[i] = (uint32_t)i;
+    std::shuffle(order.begin(), order.end(), std::mt19937(42));
+    return order;
+}
+
+// ---------------- dict: zone dictionary lookup latency and footprint ----------------
+static void benchDict(size_t n) {
+    auto keys = zoneKeys(n);
+    auto order = shuffledOrder(n);
+    unsigned long long sink = 0;
+
+    {
+        size_t before = liveBytes;
+        auto t0 = Clock::now();
+        std::unordered_map<std::string, int> m;
+        for (size_t i = 0; i < n; i++) m.emplace(keys[i], (int)i);
+        double ins = nsSince(t0, n);
+        double bytes = (double)(liveBytes - before) / (double)n;
+
+        t0 = Clock::now();
+        for (uint32_t i : order) sink += m.find(keys[i])->second;
+        double hit = nsSince(t0, n);
+        std::printf("  unordered_map  n=%-9zu insert %6.1f ns  lookup %6.1f ns  %6.1f B/key\n",
+                    n, ins, hit, bytes);
+    }
+
+    {
+        size_t before = liveBytes;
+        auto t0 = Clock::now();
+        ZoneDict d;
+        for (size_t i = 0; i < n; i++) d.intern(keys[i]);
+        double ins = nsSince(t0, n);
+        double bytes = (double)(liveBytes - before) / (double)n;
+
+        t0 = Clock::now();
+        for (uint32_t i : order) sink += d.find(keys[i]);
+        double hit = nsSince(t0, n);
+        std::printf("  ZoneDict       n=%-9zu insert %6.1f ns  lookup %6.1f ns  %6.1f B/key\n",
+                    n, ins, hit, bytes);
+    }
+
+    if (sink == 42) std::puts("");
+}
+
+// ---------------- arena: resident memory of the zone dictionary ----------------
+static size_t residentBytes() {
+    long pages = 0, resident = 0;
+    if (FILE* f = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(f, "%ld %ld", &pages, &resident) != 2) resident = 0;
+        std::fclose(f);
+    }
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Builds the dictionary for n distinct zones in a child process and reports
+// how much resident memory and live heap it added. `withNameCopies` also
+// keeps a deque<string> of names next to the dictionary, the way zone names
+// were stored before the arena became their only home.
+static void benchArena(size_t n, bool withNameCopies) {
+    std::fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0) {
+        waitpid(pid, nullptr, 0);
+        return;
+    }
+
+    size_t rss0 = residentBytes(), heap0 = liveBytes;
+    ZoneDict d;
+    std::deque<std::string> names;
+    char buf[32];
+    for (size_t i = 0; i < n; i++) {
+        int len = std::snprintf(buf, sizeof buf, "Z%07zu", i);
+        d.intern(std::string_view(buf, (size_t)len));
+        if (withNameCopies) names.emplace_back(buf, (size_t)len);
+    }
+    double mb = 1024.0 * 1024.0;
+    std::printf("  %-22s n=%-9zu RSS +%7.1f MiB  heap +%7.1f MiB  (%.1f B/zone)\n",
+                withNameCopies ? "dict + deque<string>" : "dict (arena only)", n,
+                (double)(residentBytes() - rss0) / mb, (double)(liveBytes - heap0) / mb,
+                (double)(liveBytes - heap0) / (double)n);
+    std::fflush(stdout);
+    _exit(0);
+}
+
+// ---------------- topk: topZones(10) selection over m zones ----------------
+static void benchTopK(size_t m) {
+    ZoneDict d;
+    for (const auto& key : zoneKeys(m)) d.intern(key);
+    std::vector<long long> total(m);
+    std::mt19937 rng(7);
+    for (auto& c : total) c = 1 + rng() % 1000;   // plenty of ties
+    const size_t k = 10;
+
+    // Previous implementation: copy every zone out, sort everything.
+    auto t0 = Clock::now();
+    std::vector<ZoneCount> all;
+    for (size_t i = 0; i < m; i++) all.push_back({std::string(d.key((uint32_t)i)), total[i]});
+    std::sort(all.begin(), all.end(), [](const ZoneCount& a, const ZoneCount& b) {
+        if (a.count != b.count) return a.count > b.count;
+        return a.zone < b.zone;
+    });
+    all.resize(k);
+    double fullMs = nsSince(t0, 1) / 1e6;
+
+    t0 = Clock::now();
+    auto best = makeTopK<uint32_t>(k, [&](uint32_t a, uint32_t b) {
+        if (total[a] != total[b]) return total[a] > total[b];
+        return d.key(a) < d.key(b);
+    });
+    for (size_t i = 0; i < m; i++) best.push((uint32_t)i);
+    std::vector<ZoneCount> top;
+    for (uint32_t id : best.take()) top.push_back({std::string(d.key(id)), total[id]});
+    double heapMs = nsSince(t0, 1) / 1e6;
+
+    bool same = true;
+    for (size_t i = 0; i < k; i++) same = same && top[i].zone == all[i].zone && top[i].count == all[i].count;
+    std::printf("  m=%-9zu full sort %8.1f ms   bounded heap %7.1f ms   %s\n",
+                m, fullMs, heapMs, same ? "same result" : "MISMATCH");
+}
+
+// ---------------- order: ingest of clustered vs shuffled rows ----------------
+// 2M rows over `zones` zones, as CSV text. Clustered: each zone's rows are
+// contiguous and hours change every 50 rows, as in dumps sorted by zone
+// (or the C3 burst of one zone). Shuffled: the same rows in random order.
+static void benchOrder(size_t zones) {
+    const size_t rows = 2000000;
+    std::vector<std::string> keys = zoneKeys(zones);
+    std::vector<std::string> lines(rows);
+    char buf[64];
+    for (size_t i = 0; i < rows; i++) {
+        size_t zone = i * zones / rows;
+        std::snprintf(buf, sizeof buf, "%zu,%s,2024-01-01 %02zu:00\n", i, keys[zone].c_str(), (i / 50) % 24);
+        lines[i] = buf;
+    }
+
+    auto run = [&](const char* name, const std::vector<uint32_t>* order) {
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (size_t i = 0; i < rows; i++) csv += lines[order ? (*order)[i] : i];
+        double best = 1e30;
+        for (int rep = 0; rep < 5; rep++) {
+            TripAnalyzer a;
+            a.setEngine(AggregationEngine::Hash);
+            auto t0 = Clock::now();
+            a.ingestBuffer(csv.data(), csv.size());
+            best = std::min(best, nsSince(t0, rows));
+        }
+        std::printf("  zones=%-8zu %-9s %6.1f ns/row\n", zones, name, best);
+    };
+    std::vector<uint32_t> order = shuffledOrder(rows);
+    run("clustered", nullptr);
+    run("shuffled", &order);
+}
+
+// ---------------- unique: one row per zone, the C1 shape ----------------
+// Once the dictionary outgrows the cache every lookup misses; compares the
+// hash engine's batched, prefetching lookups with radix partitioning.
+static void benchUnique(size_t n) {
+    std::vector<std::string> keys = zoneKeys(n);
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    char buf[64];
+    for (size_t i = 0; i < n; i++) {
+        std::snprintf(buf, sizeof buf, "%zu,%s,2024-01-01 %02zu:00\n", i, keys[i].c_str(), i % 24);
+        csv += buf;
+    }
+    keys = {};
+
+    for (AggregationEngine e : {AggregationEngine::Hash, AggregationEngine::Radix}) {
+        double best = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+            TripAnalyzer a;
+            a.setEngine(e);
+            auto t0 = Clock::now();
+            a.ingestBuffer(csv.data(), csv.size());
+            best = std::min(best, nsSince(t0, n));
+        }
+        std::printf("  n=%-9zu %-5s %6.1f ns/row\n", n, e == AggregationEngine::Hash ? "hash" : "radix", best);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string what = argc > 1 ? argv[1] : "dict";
+    std::vector<size_t> sizes;
+    for (int i = 2; i < argc; i++) sizes.push_back(std::strtoull(argv[i], nullptr, 10));
+
+    if (what == "dict") {
+        if (sizes.empty()) sizes = {150000, 1000000, 5000000};
+        std::puts("dict: random-order hits over C1-shaped keys");
+        for (size_t n : sizes) benchDict(n);
+        return 0;
+    }
+
+    if (what == "arena") {
+        if (sizes.empty()) sizes = {10000000};
+        std::puts("arena: memory for distinct C1-shaped zone names");
+        for (size_t n : sizes) {
+            benchArena(n, true);
+            benchArena(n, false);
+        }
+        return 0;
+    }
+
+    if (what == "topk") {
+        if (sizes.empty()) sizes = {1000000, 10000000};
+        std::puts("topk: k=10 zones, counts uniform in [1, 1000]");
+        for (size_t m : sizes) benchTopK(m);
+        return 0;
+    }
+
+    if (what == "order") {
+        if (sizes.empty()) sizes = {4, 1000, 100000};
+        std::puts("order: ingest of 2M rows through the hash engine, one thread");
+        for (size_t n : sizes) benchOrder(n);
+        return 0;
+    }
+
+    if (what == "unique") {
+        if (sizes.empty()) sizes = {1000000, 4000000};
+        std::puts("unique: ingest of N rows with N distinct zones, one thread");
+        for (size_t n : sizes) benchUnique(n);
+        return 0;
+    }
+
+    std::fprintf(stderr, "usage: %s dict|arena|topk|order|unique [N ...]\n", argv[0]);
+    return 1;
+}
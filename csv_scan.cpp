@@ -0,0 +1,76 @@
+#include "csv_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSV_SCAN_X86 1
+#endif
+
+namespace {
+
+void scanScalar(const char* p, uint64_t& commas, uint64_t& newlines) {
+    uint64_t c = 0, n = 0;
+    for (int i = 0; i < 64; i++) {
+        c |= (uint64_t)(p[i] == ',')  << i;
+        n |= (uint64_t)(p[i] == '\n') << i;
+    }
+    commas = c;
+    newlines = n;
+}
+
+#ifdef CSV_SCAN_X86
+
+__attribute__((target("sse2")))
+void scanSse2(const char* p, uint64_t& commas, uint64_t& newlines) {
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i nl    = _mm_set1_epi8('\n');
+    uint64_t c = 0, n = 0;
+    for (int i = 0; i < 4; i++) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16 * i));
+        c |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, comma)) << (16 * i);
+        n |= (uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl)) << (16 * i);
+    }
+    commas = c;
+    newlines = n;
+}
+
+__attribute__((target("avx2")))
+void scanAvx2(const char* p, uint64_t& commas, uint64_t& newlines) {
+    const __m256i comma = _mm256_set1_epi8(',');
+    const __m256i nl    = _mm256_set1_epi8('\n');
+    __m256i lo = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i hi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+    commas = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, comma))
+           | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, comma)) << 32;
+    newlines = (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, nl))
+             | (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, nl)) << 32;
+}
+
+#endif
+
+using ScanFn = void (*)(const char*, uint64_t&, uint64_t&);
+
+ScanFn pickKernel() {
+#ifdef CSV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return scanAvx2;
+    if (__builtin_cpu_supports("sse2")) return scanSse2;
+#endif
+    return scanScalar;
+}
+
+}
+
+void scanBlock64(const char* p, uint64_t& commas, uint64_t& newlines) {
+    static const ScanFn kernel = pickKernel();
+    kernel(p, commas, newlines);
+}
+
+std::vector<ScanKernel> scanKernels() {
+    std::vector<ScanKernel> list = {{"scalar", scanScalar}};
+#ifdef CSV_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) list.push_back({"sse2", scanSse2});
+    if (__builtin_cpu_supports("avx2")) list.push_back({"avx2", scanAvx2});
+#endif
+    return list;
+}
@@ -0,0 +1,70 @@
+#ifndef CSV_SCAN_H
+#define CSV_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Fills bit i of `commas` / `newlines` when byte p[i] is ',' / '\n', for the
+// 64 bytes starting at p. Uses AVX2 or SSE2 when the CPU has them (chosen
+// once at runtime) and a scalar loop otherwise.
+void scanBlock64(const char* p, uint64_t& commas, uint64_t& newlines);
+
+// One implementation of scanBlock64. scanKernels() lists those this CPU can
+// run, scalar first, so tests can check each against the others.
+struct ScanKernel {
+    const char* name;
+    void (*scan)(const char* p, uint64_t& commas, uint64_t& newlines);
+};
+std::vector<ScanKernel> scanKernels();
+
+// Structural scanner over a byte range. The range is classified one 64-byte
+// block at a time into comma/newline bitmasks, and delimiter lookups are
+// answered from the cached masks with a count-trailing-zeros.
+class CsvScanner {
+public:
+    CsvScanner(const char* begin, const char* end)
+        : base(begin), len((size_t)(end - begin)) {}
+
+    // First ',' or '\n' at or after p, or the end of the range.
+    const char* nextDelim(const char* p) { return next((size_t)(p - base), true); }
+
+    // First '\n' at or after p, or the end of the range.
+    const char* nextNewline(const char* p) { return next((size_t)(p - base), false); }
+
+private:
+    const char* next(size_t i, bool withCommas) {
+        while (i < len) {
+            size_t b = i & ~(size_t)63;
+            if (b != blk) load(b);
+
+            uint64_t m = (withCommas ? delims : newlines) >> (i & 63);
+            if (m) return base + i + __builtin_ctzll(m);
+            i = b + 64;
+        }
+        return base + len;
+    }
+
+    void load(size_t b) {
+        blk = b;
+        uint64_t commas = 0;
+        if (len - b >= 64) {
+            scanBlock64(base + b, commas, newlines);
+        } else {
+            newlines = 0;
+            for (size_t i = 0; i < len - b; i++) {
+                commas   |= (uint64_t)(base[b + i] == ',')  << i;
+                newlines |= (uint64_t)(base[b + i] == '\n') << i;
+            }
+        }
+        delims = commas | newlines;
+    }
+
+    const char* base;
+    size_t len;
+    size_t blk = ~(size_t)0;   // offset of the classified block
+    uint64_t delims = 0;
+    uint64_t newlines = 0;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include "gz_reader.h"
+#include <algorithm>
+#include <memory>
+#include <zlib.h>
+
+using namespace std;
+
+namespace {
+
+const size_t kBlockBytes = 1 << 20;
+const size_t kQueuedBlocks = 4;
+const size_t kInputBytes = 256 << 10;
+
+}
+
+bool isGzip(const char* p, size_t len) {
+    return len >= 2 && (unsigned char)p[0] == 0x1f && (unsigned char)p[1] == 0x8b;
+}
+
+GzipReader::GzipReader(const char* head, size_t headLen, Source more)
+    : head(head), headLen(headLen), more(move(more)) {
+    worker = thread([this] { run(); });
+}
+
+GzipReader::~GzipReader() {
+    {
+        lock_guard<mutex> g(lock);
+        closing = true;
+    }
+    drained.notify_all();
+    worker.join();
+}
+
+bool GzipReader::next(vector<char>& block) {
+    unique_lock<mutex> g(lock);
+    ready.wait(g, [this] { return !full.empty() || done; });
+    if (full.empty()) return false;
+
+    // The caller's previous buffer goes back to the inflater.
+    block.swap(full.front());
+    if (full.front().capacity() > 0) spare.push_back(move(full.front()));
+    full.pop_front();
+    g.unlock();
+    drained.notify_one();
+    return true;
+}
+
+bool GzipReader::ok() const {
+    lock_guard<mutex> g(lock);
+    return !failed;
+}
+
+// Queues a filled block, waiting while the queue is full, and leaves an
+// empty buffer in `block` for the next one. False if the reader is closing.
+bool GzipReader::push(vector<char>& block) {
+    unique_lock<mutex> g(lock);
+    drained.wait(g, [this] { return full.size() < kQueuedBlocks || closing; });
+    if (closing) return false;
+
+    full.push_back(move(block));
+    block.clear();
+    if (!spare.empty()) {
+        block = move(spare.back());
+        spare.pop_back();
+    }
+    g.unlock();
+    ready.notify_one();
+    return true;
+}
+
+void GzipReader::run() {
+    z_stream z{};
+    // 15 + 32: full window, gzip or zlib header detected automatically.
+    bool good = inflateInit2(&z, 15 + 32) == Z_OK;
+    bool inMember = false;   // started a member whose end has not been seen
+
+    size_t headPos = 0;
+    unique_ptr<char[]> input;
+
+    // Points z at the next piece of compressed input; false at the end.
+    auto refill = [&]() -> bool {
+        if (headPos < headLen) {
+            size_t n = min(headLen - headPos, (size_t)1 << 30);
+            z.next_in = (Bytef*)(head + headPos);
+            z.avail_in = (uInt)n;
+            headPos += n;
+            return true;
+        }
+        if (!more) return false;
+        if (!input) input.reset(new char[kInputBytes]);
+        size_t n = more(input.get(), kInputBytes);
+        z.next_in = (Bytef*)input.get();
+        z.avail_in = (uInt)n;
+        return n > 0;
+    };
+
+    vector<char> block;
+    size_t used = 0;
+    bool open = true;
+    while (good && open) {
+        if (z.avail_in == 0 && !refill()) break;
+
+        if (used == 0) block.resize(kBlockBytes);
+        z.next_out = (Bytef*)(block.data() + used);
+        z.avail_out = (uInt)(kBlockBytes - used);
+
+        int rc = inflate(&z, Z_NO_FLUSH);
+        used = kBlockBytes - z.avail_out;
+        inMember = true;
+
+        if (rc == Z_STREAM_END) {
+            // Another member may follow (as written by `cat a.gz b.gz`).
+            inMember = false;
+            good = inflateReset(&z) == Z_OK;
+        } else if (rc != Z_OK && rc != Z_BUF_ERROR) {
+            good = false;
+        }
+
+        if (used == kBlockBytes) {
+            open = push(block);
+            used = 0;
+        }
+    }
+    inflateEnd(&z);
+
+    if (open && used > 0) {
+        block.resize(used);
+        push(block);
+    }
+
+    lock_guard<mutex> g(lock);
+    done = true;
+    failed = !good || inMember;
+    ready.notify_all();
+}
@@ -0,0 +1,60 @@
+#ifndef GZ_READER_H
+#define GZ_READER_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// True if the bytes start with the gzip magic number.
+bool isGzip(const char* p, std::size_t len);
+
+// Inflates a gzip stream (one or more concatenated members) on a thread of
+// its own and hands the decompressed bytes out in blocks, in order. At most
+// a few blocks are buffered, so a slow consumer holds the inflater back
+// instead of letting memory grow.
+class GzipReader {
+public:
+    // Returns up to n more compressed bytes, or 0 at end of input.
+    using Source = std::function<std::size_t(char* dst, std::size_t n)>;
+
+    // The compressed input is head[0, headLen) followed by whatever `more`
+    // returns (if set). head must stay valid until the reader is destroyed.
+    GzipReader(const char* head, std::size_t headLen, Source more = nullptr);
+    ~GzipReader();
+
+    GzipReader(const GzipReader&) = delete;
+    GzipReader& operator=(const GzipReader&) = delete;
+
+    // Swaps the next decompressed block into `block` (its old buffer is
+    // reused). Returns false once the stream is exhausted.
+    bool next(std::vector<char>& block);
+
+    // False if the input was truncated or corrupt; the blocks handed out
+    // before the error are still valid.
+    bool ok() const;
+
+private:
+    void run();
+    bool push(std::vector<char>& block);
+
+    const char* head;
+    std::size_t headLen;
+    Source more;
+
+    mutable std::mutex lock;
+    std::condition_variable ready;     // a block was queued, or inflate ended
+    std::condition_variable drained;   // queue has room, or reader is closing
+    std::deque<std::vector<char>> full;
+    std::vector<std::vector<char>> spare;
+    bool done = false;
+    bool failed = false;
+    bool closing = false;
+
+    std::thread worker;
+};
+
+#endif
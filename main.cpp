@@ -1,6 +1,14 @@
 #include "analyzer.h"
 #include <iostream>
+#include <algorithm>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glob.h>
 
 static void printZones(const std::vector<ZoneCount>& v) {
     std::cout << "TOP_ZONES\n";
@@ -14,11 +22,113 @@ static void printSlots(const std::vector<SlotCount>& v) {
         std::cout << x.zone << "," << x.hour << "," << x.count << "\n";
 }
 
-int main() {
+static void printStats(const IngestStats& s, bool pipelined) {
+    static const char* const kEngines[] = {"none", "tiny", "hash", "radix"};
+    std::fprintf(stderr, "engine %s (~%zu zones estimated)\n", kEngines[(int)s.engine],
+                 s.estimatedZones);
+    if (!pipelined) return;
+
+    std::cerr << "stage      busy_ms   wait_ms\n";
+    auto row = [](const char* name, double busy, double wait) {
+        std::fprintf(stderr, "%-9s %8.1f %9.1f\n", name, busy, wait);
+    };
+    row("read", s.readMs, s.readWaitMs);
+    row("parse", s.parseMs, s.parseWaitMs);
+    row("aggregate", s.aggregateMs, s.aggregateWaitMs);
+    std::fprintf(stderr, "%zu bytes, %zu rows in %.1f ms\n", s.bytes, s.rows, s.totalMs);
+}
+
+// Keeps reading a growing file, printing fresh rankings whenever new rows
+// arrive. Runs until interrupted.
+static int followFile(const std::string& path) {
+    TripAnalyzer analyzer;
+    analyzer.follow(path);
+    for (;;) {
+        if (analyzer.poll() > 0) {
+            printZones(analyzer.topZones(10));
+            printSlots(analyzer.topBusySlots(10));
+            std::cout << std::flush;
+        }
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+    }
+}
+
+static bool isCsvName(const std::string& name) {
+    auto endsWith = [&](const char* suffix) {
+        std::string s = suffix;
+        return name.size() >= s.size() && name.compare(name.size() - s.size(), s.size(), s) == 0;
+    };
+    return endsWith(".csv") || endsWith(".csv.gz");
+}
+
+// Expands one command-line input: a directory yields its *.csv and
+// *.csv.gz files, a quoted glob pattern its matches, anything else itself.
+// Returns false if the input expanded to nothing.
+static bool expandInput(const std::string& arg, std::vector<std::string>& out) {
+    std::error_code ec;
+    if (std::filesystem::is_directory(arg, ec)) {
+        std::vector<std::string> found;
+        for (auto& e : std::filesystem::directory_iterator(arg, ec)) {
+            if (e.is_regular_file(ec) && isCsvName(e.path().filename().string()))
+                found.push_back(e.path().string());
+        }
+        std::sort(found.begin(), found.end());
+        out.insert(out.end(), found.begin(), found.end());
+        return !found.empty();
+    }
+    if (arg.find_first_of("*?[") != std::string::npos) {
+        glob_t g;
+        bool matched = glob(arg.c_str(), 0, nullptr, &g) == 0;
+        if (matched) {
+            for (size_t i = 0; i < g.gl_pathc; i++) out.push_back(g.gl_pathv[i]);
+        }
+        globfree(&g);
+        return matched;
+    }
+    out.push_back(arg);
+    return true;
+}
+
+// usage: app [--follow] [--pipeline] [--stats] [-j threads] [input...]
+// An input is a CSV file, "-" for stdin (e.g. `zstd -dc trips.csv.zst | app -`),
+// a directory of CSV files or a glob pattern. Several inputs are ingested
+// together, in parallel across the threads (default: all cores). With no
+// input at all SmallTrips.csv is read; a directory or glob that yields no
+// files is an error.
+// --pipeline reads, parses and counts on separate threads and prints each
+// stage's busy and waiting time to stderr. --stats prints the aggregation
+// engine the input's sample chose.
+int main(int argc, char** argv) {
+    std::vector<std::string> paths;
+    bool follow = false;
+    bool pipeline = false;
+    bool stats = false;
+    unsigned threads = 0;
+    bool anyInput = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--follow") follow = true;
+        else if (arg == "--pipeline") pipeline = true;
+        else if (arg == "--stats") stats = true;
+        else if (arg == "-j" && i + 1 < argc) threads = (unsigned)std::atoi(argv[++i]);
+        else {
+            anyInput = true;
+            if (!expandInput(arg, paths)) {
+                std::cerr << arg << ": no CSV files found\n";
+                return 1;
+            }
+        }
+    }
+    if (!anyInput) paths.push_back("SmallTrips.csv");
+    if (follow) return followFile(paths[0]);
+
     auto t0 = std::chrono::high_resolution_clock::now();
 
     TripAnalyzer analyzer;
-    analyzer.ingestFile("SmallTrips.csv");
+    analyzer.setThreads(threads);
+    analyzer.setPipeline(pipeline);
+    if (paths.size() == 1) analyzer.ingestFile(paths[0]);
+    else analyzer.ingestFiles(paths);
 
     printZones(analyzer.topZones(10));
     printSlots(analyzer.topBusySlots(10));
@@ -27,5 +137,6 @@ int main() {
     auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
 
     std::cout << "EXEC_MS\n" << ms << "\n";
+    if (pipeline || stats) printStats(analyzer.ingestStats(), pipeline);
     return 0;
 }
@@ -0,0 +1,95 @@
+// Combines partial aggregates into one result.
+//
+//   ./merge [-o out.snap] [-k K] part1.snap part2.snap ... [day.csv ...]
+//
+// Inputs named *.snap or starting with the snapshot magic are loaded as
+// snapshots written by TripAnalyzer::saveSnapshot (or by a previous merge);
+// one that does not load is an error, so a damaged shard is never dropped
+// silently. Anything else is ingested as CSV (plain or gzip).
+// The merged rankings are printed in the same format as app, and -o also
+// writes the merged state as a snapshot.
+
+#include "analyzer.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+static bool endsWith(const std::string& s, const std::string& suffix) {
+    return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void printZones(const std::vector<ZoneCount>& v) {
+    std::cout << "TOP_ZONES\n";
+    for (auto& x : v)
+        std::cout << x.zone << "," << x.count << "\n";
+}
+
+static void printSlots(const std::vector<SlotCount>& v) {
+    std::cout << "TOP_SLOTS\n";
+    for (auto& x : v)
+        std::cout << x.zone << "," << x.hour << "," << x.count << "\n";
+}
+
+static int usage(const char* argv0) {
+    std::cerr << "usage: " << argv0 << " [-o out.snap] [-k K] input...\n";
+    return 2;
+}
+
+// Parses a non-negative count; false on anything else.
+static bool parseCount(const char* s, int& value) {
+    char* end;
+    errno = 0;
+    long v = std::strtol(s, &end, 10);
+    if (end == s || *end != '\0' || errno != 0 || v < 0 || v > INT_MAX) return false;
+    value = (int)v;
+    return true;
+}
+
+int main(int argc, char** argv) {
+    std::string out;
+    int k = 10;
+    std::vector<std::string> inputs;
+    for (int i = 1; i < argc; i++) {
+        std::string a = argv[i];
+        if (a == "-o" && i + 1 < argc) out = argv[++i];
+        else if (a == "-k" && i + 1 < argc) {
+            if (!parseCount(argv[++i], k)) {
+                std::cerr << argv[i] << ": -k needs a non-negative number\n";
+                return usage(argv[0]);
+            }
+        }
+        else inputs.push_back(a);
+    }
+    if (inputs.empty()) return usage(argv[0]);
+
+    TripAnalyzer total;
+    for (const auto& in : inputs) {
+        TripAnalyzer part;
+        if (!std::ifstream(in)) {
+            std::cerr << in << ": cannot open\n";
+            return 1;
+        }
+        if (endsWith(in, ".snap") || TripAnalyzer::isSnapshot(in)) {
+            if (!part.loadSnapshot(in)) {
+                std::cerr << in << ": not a readable snapshot\n";
+                return 1;
+            }
+        } else {
+            part.ingestFile(in);
+        }
+        total.merge(std::move(part));
+    }
+
+    printZones(total.topZones(k));
+    printSlots(total.topBusySlots(k));
+
+    if (!out.empty() && !total.saveSnapshot(out)) {
+        std::cerr << out << ": could not write snapshot\n";
+        return 1;
+    }
+    return 0;
+}
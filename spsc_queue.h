@@ -0,0 +1,62 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// Bounded lock-free ring buffer for exactly one producer thread and one
+// consumer thread. Each side owns one index and publishes it with a release
+// store; the other side's index is re-read (acquire) only when the cached
+// copy says the ring looks full or empty, so the two cores rarely touch the
+// same cache line.
+template <class T>
+class SpscQueue {
+public:
+    // Capacity is rounded up to a power of two.
+    explicit SpscQueue(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) n <<= 1;
+        slots.resize(n);
+        mask = n - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    // Producer side. False if the ring is full.
+    bool tryPush(T v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headSeen > mask) {
+            headSeen = head.load(std::memory_order_acquire);
+            if (t - headSeen > mask) return false;
+        }
+        slots[t & mask] = std::move(v);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. False if the ring is empty.
+    bool tryPop(T& v) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailSeen) {
+            tailSeen = tail.load(std::memory_order_acquire);
+            if (h == tailSeen) return false;
+        }
+        v = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask = 0;
+
+    alignas(64) std::atomic<size_t> head{0};   // next slot to pop; written by the consumer
+    size_t tailSeen = 0;                       // consumer's copy of tail
+    alignas(64) std::atomic<size_t> tail{0};   // next slot to fill; written by the producer
+    size_t headSeen = 0;                       // producer's copy of head
+};
+
+#endif
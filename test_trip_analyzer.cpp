@@ -1,5 +1,6 @@
 #include "catch_amalgamated.hpp"
 #include "analyzer.h"
+#include "csv_scan.h"
 
 #include <filesystem>
 #include <fstream>
@@ -8,6 +9,13 @@
 #include <tuple>
 #include <cstdlib>
 #include <chrono>
+#include <thread>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <random>
 
 namespace fs = std::filesystem;
 
@@ -322,3 +330,704 @@ TEST_CASE_METHOD(TripsFixture,
     const long long limit = envMs("C3_LIMIT_MS", fastMode() ? 3500 : 9000);
     REQUIRE(ms < limit);
 }
+
+// =============================================================
+// CATEGORY D: Ingest engine extensions
+// =============================================================
+static std::string mixedCsv(int n) {
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    for (int i = 0; i < n; i++) {
+        int h = (i * 7) % 24;
+        csv += std::to_string(i + 1) + ",Z" + std::to_string((i * 31) % 997) + ",2024-01-01 ";
+        if (h < 10) csv += "0";
+        csv += std::to_string(h) + ":00\n";
+        if (i % 1000 == 0) csv += "BAD,LINE\n";
+    }
+    return csv;
+}
+
+struct Rankings {
+    std::vector<ZoneCount> zones;
+    std::vector<SlotCount> slots;
+};
+
+static Rankings rankingsOf(const TripAnalyzer& a, int k = 50) {
+    return {a.topZones(k), a.topBusySlots(k)};
+}
+
+static void requireSameRankings(const Rankings& got, const Rankings& exp) {
+    REQUIRE(got.zones.size() == exp.zones.size());
+    for (size_t i = 0; i < exp.zones.size(); i++) {
+        INFO("Zone index " << i);
+        REQUIRE(got.zones[i].zone == exp.zones[i].zone);
+        REQUIRE(got.zones[i].count == exp.zones[i].count);
+    }
+
+    REQUIRE(got.slots.size() == exp.slots.size());
+    for (size_t i = 0; i < exp.slots.size(); i++) {
+        INFO("Slot index " << i);
+        REQUIRE(got.slots[i].zone == exp.slots[i].zone);
+        REQUIRE(got.slots[i].hour == exp.slots[i].hour);
+        REQUIRE(got.slots[i].count == exp.slots[i].count);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D1 Parallel ingest matches serial ingest", "[D]") {
+    writeTripsCsv(mixedCsv(200000));
+
+    TripAnalyzer serial;
+    serial.ingestFile("Trips.csv");
+    Rankings exp = rankingsOf(serial);
+
+    TripAnalyzer parallel;
+    parallel.setThreads(4);
+    parallel.ingestFile("Trips.csv");
+
+    requireSameRankings(rankingsOf(parallel), exp);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D2 Independent analyzers ingest concurrently", "[D]") {
+    // Analyzer i sees zones R<i>Z0..R<i>Z<i+2>; zone j has (j+1)*1000 trips at hour j.
+    const int T = 6;
+    for (int i = 0; i < T; i++) {
+        std::ofstream out("R" + std::to_string(i) + ".csv", std::ios::binary);
+        out << "TripID,PickupZoneID,PickupTime\n";
+        for (int j = 0; j < i + 3; j++)
+            for (int r = 0; r < (j + 1) * 1000; r++)
+                out << r << ",R" << i << "Z" << j << ",2024-01-01 " << zpad(j, 2) << ":30\n";
+    }
+
+    std::vector<TripAnalyzer> analyzers(T);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < T; i++)
+        workers.emplace_back([&analyzers, i] {
+            analyzers[i].ingestFile("R" + std::to_string(i) + ".csv");
+        });
+    for (auto& w : workers) w.join();
+
+    for (int i = 0; i < T; i++) {
+        INFO("Analyzer " << i);
+        std::string top = "R" + std::to_string(i) + "Z" + std::to_string(i + 2);
+        auto z = analyzers[i].topZones(100);
+        REQUIRE(z.size() == (size_t)(i + 3));
+        REQUIRE(z[0].zone == top);
+        REQUIRE(z[0].count == (i + 3) * 1000);
+
+        auto s = analyzers[i].topBusySlots(1);
+        REQUIRE(s.size() == 1);
+        REQUIRE(s[0].zone == top);
+        REQUIRE(s[0].hour == i + 2);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D3 Top-k selection matches a full sort, ties included", "[D]") {
+    // 500 zones whose counts collide heavily; names are not in count order.
+    std::map<std::string, long long> counts;
+    std::map<std::pair<std::string, int>, long long> cells;
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    int id = 1;
+    for (int z = 0; z < 500; z++) {
+        std::string zone = "Q" + std::to_string((z * 7919) % 500);
+        int n = 1 + (z * 37) % 9;
+        counts[zone] += n;
+        for (int r = 0; r < n; r++) {
+            cells[{zone, r % 4}]++;
+            csv += std::to_string(id++) + "," + zone + ",2024-01-01 0" + std::to_string(r % 4) + ":00\n";
+        }
+    }
+    writeTripsCsv(csv);
+
+    std::vector<std::pair<std::string, long long>> all(counts.begin(), counts.end());
+    std::stable_sort(all.begin(), all.end(), [](const auto& a, const auto& b) {
+        return a.second > b.second;
+    });
+
+    std::vector<std::tuple<std::string, int, long long>> allSlots;
+    for (const auto& c : cells) allSlots.emplace_back(c.first.first, c.first.second, c.second);
+    std::stable_sort(allSlots.begin(), allSlots.end(), [](const auto& a, const auto& b) {
+        return std::get<2>(a) > std::get<2>(b);
+    });
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    for (int k : {1, 10, 77, 500, 3000}) {
+        INFO("k=" << k);
+        std::vector<std::pair<std::string, long long>> exp(all.begin(),
+                                                           all.begin() + std::min<size_t>(k, all.size()));
+        requireZonesEq(a.topZones(k), exp);
+
+        std::vector<std::tuple<std::string, int, long long>> expSlots(
+            allSlots.begin(), allSlots.begin() + std::min<size_t>(k, allSlots.size()));
+        requireSlotsEq(a.topBusySlots(k), expSlots);
+    }
+    REQUIRE(a.topZones(0).empty());
+    REQUIRE(a.topBusySlots(0).empty());
+}
+
+TEST_CASE_METHOD(TripsFixture, "D4 Columns are located from the header", "[D]") {
+    std::string rows =
+        "1,Z1,Z9,2024-01-01 10:30,3.5,12.0\n"
+        "2,Z1,Z8,2024-01-01 10:45,1.0,7.5\n"
+        "3,Z2,Z9,2024-01-01 11:05,2.2,9.0\n"
+        "4,Z2,Z9,BAD,2.2,9.0\n"
+        "5,Z3,Z9\n";
+
+    SECTION("named columns in any position") {
+        writeTripsCsv("TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n" + rows);
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+        requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 11, 1}});
+    }
+
+    SECTION("configured column names") {
+        writeTripsCsv("TripID,PickupZoneID,DropoffZoneID,PickupTime,Distance,Fare\n" + rows);
+        TripAnalyzer a;
+        a.setColumns("DropoffZoneID", "PickupTime");
+        a.ingestFile("Trips.csv");
+        requireZonesEq(a.topZones(10), {{"Z9", 2}, {"Z8", 1}});
+    }
+
+    SECTION("only one column named: the other keeps its default") {
+        writeTripsCsv("TripID,PickupZone,DropoffZone,PickupTime,Distance,Fare\n" + rows);
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+        requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 11, 1}});
+    }
+
+    SECTION("headerless file: first row is data") {
+        writeTripsCsv(rows);
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D5 Sidecar cache reproduces results and goes stale with the CSV", "[D]") {
+    writeTripsCsv(mixedCsv(20000));
+
+    TripAnalyzer plain;
+    plain.ingestFile("Trips.csv");
+    Rankings exp = rankingsOf(plain);
+    REQUIRE_FALSE(fs::exists("Trips.csv.tacache"));
+
+    TripAnalyzer cold;
+    cold.setSidecarCache(true);
+    cold.ingestFile("Trips.csv");
+    REQUIRE(fs::exists("Trips.csv.tacache"));
+    requireSameRankings(rankingsOf(cold), exp);
+
+    TripAnalyzer warm;
+    warm.setSidecarCache(true);
+    warm.ingestFile("Trips.csv");
+    requireSameRankings(rankingsOf(warm), exp);
+
+    // A zone id past the zone table (997 zones, two-byte ids, followed by
+    // one hour byte per row) rejects the sidecar instead of being counted.
+    {
+        std::fstream f("Trips.csv.tacache", std::ios::in | std::ios::out | std::ios::binary);
+        f.seekp((std::streamoff)fs::file_size("Trips.csv.tacache") - 20000 - 2);
+        f.write("\xff\xff", 2);
+    }
+    TripAnalyzer corrupt;
+    corrupt.setSidecarCache(true);
+    corrupt.ingestFile("Trips.csv");
+    requireSameRankings(rankingsOf(corrupt), exp);
+
+    // Header counts picked so that the size check wraps around to the real
+    // file size (zone count at offset 48, arena bytes at 56, row count at
+    // 64, zone id width at 12) are rejected before anything is sized from
+    // them.
+    {
+        std::fstream f("Trips.csv.tacache", std::ios::in | std::ios::out | std::ios::binary);
+        uint64_t arenaBytes;
+        f.seekg(56);
+        f.read(reinterpret_cast<char*>(&arenaBytes), 8);
+        const uint32_t width = 4;
+        const uint64_t zones = (uint64_t)1 << 40;
+        uint64_t rest = fs::file_size("Trips.csv.tacache") - 72 - (zones + 1) * 4 - arenaBytes;
+        uint64_t rows = rest * 0xCCCCCCCCCCCCCCCDull;   // rest / 5 modulo 2^64
+        f.seekp(12);
+        f.write(reinterpret_cast<const char*>(&width), 4);
+        f.seekp(48);
+        f.write(reinterpret_cast<const char*>(&zones), 8);
+        f.seekp(64);
+        f.write(reinterpret_cast<const char*>(&rows), 8);
+    }
+    TripAnalyzer huge;
+    huge.setSidecarCache(true);
+    REQUIRE_NOTHROW(huge.ingestFile("Trips.csv"));
+    requireSameRankings(rankingsOf(huge), exp);
+
+    // Same size, different content: the checksum must catch it.
+    std::string csv = mixedCsv(20000);
+    csv.replace(csv.find(",Z0,"), 4, ",Y0,");
+    writeTripsCsv(csv);
+    TripAnalyzer changed;
+    changed.setSidecarCache(true);
+    changed.ingestFile("Trips.csv");
+    auto z = changed.topZones(1000);
+    REQUIRE(std::any_of(z.begin(), z.end(), [](const ZoneCount& c) { return c.zone == "Y0"; }));
+}
+
+TEST_CASE_METHOD(TripsFixture, "D6 Snapshots restore queryable state", "[D]") {
+    writeTripsCsv(mixedCsv(20000));
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    Rankings exp = rankingsOf(a);
+    REQUIRE(a.saveSnapshot("state.snap"));
+
+    TripAnalyzer b;
+    REQUIRE(b.loadSnapshot("state.snap"));
+    requireSameRankings(rankingsOf(b), exp);
+    REQUIRE(TripAnalyzer::isSnapshot("state.snap"));
+    REQUIRE_FALSE(TripAnalyzer::isSnapshot("Trips.csv"));
+
+    // A bad file leaves the current state alone.
+    std::ofstream("junk.snap") << "not a snapshot";
+    REQUIRE_FALSE(TripAnalyzer::isSnapshot("junk.snap"));
+    REQUIRE_FALSE(b.loadSnapshot("junk.snap"));
+    REQUIRE_FALSE(b.loadSnapshot("missing.snap"));
+    requireSameRankings(rankingsOf(b), exp);
+
+    TripAnalyzer empty;
+    REQUIRE(empty.saveSnapshot("empty.snap"));
+    REQUIRE(b.loadSnapshot("empty.snap"));
+    REQUIRE(b.topZones(10).empty());
+}
+
+// Deals the rows of csv round-robin into P0.csv .. P<n-1>.csv, each with
+// the header.
+static void writePartCsvs(const std::string& csv, int n) {
+    const std::string header = csv.substr(0, csv.find('\n') + 1);
+    std::vector<std::string> parts(n, header);
+    size_t pos = header.size();
+    for (int row = 0; pos < csv.size(); row++) {
+        size_t nl = csv.find('\n', pos);
+        parts[row % n] += csv.substr(pos, nl + 1 - pos);
+        pos = nl + 1;
+    }
+    for (int i = 0; i < n; i++)
+        std::ofstream("P" + std::to_string(i) + ".csv", std::ios::binary) << parts[i];
+}
+
+TEST_CASE_METHOD(TripsFixture, "D7 Merged partial aggregates equal a single ingest", "[D]") {
+    std::string csv = mixedCsv(30000);
+    writeTripsCsv(csv);
+    TripAnalyzer whole;
+    whole.ingestFile("Trips.csv");
+    Rankings exp = rankingsOf(whole);
+
+    writePartCsvs(csv, 3);
+
+    SECTION("in memory") {
+        TripAnalyzer a, b, c;
+        a.ingestFile("P0.csv");
+        b.ingestFile("P1.csv");
+        c.ingestFile("P2.csv");
+        a.merge(b);
+        a.merge(std::move(c));
+        requireSameRankings(rankingsOf(a), exp);
+        REQUIRE(c.topZones(1).empty());
+        a.merge(std::move(a));
+        requireSameRankings(rankingsOf(a), exp);
+
+        // A moved-from analyzer is empty and still usable.
+        TripAnalyzer moved(std::move(a));
+        requireSameRankings(rankingsOf(moved), exp);
+        REQUIRE(a.topZones(1).empty());
+        a.ingestFile("Trips.csv");
+        requireSameRankings(rankingsOf(a), exp);
+        b = std::move(a);
+        requireSameRankings(rankingsOf(b), exp);
+        REQUIRE(a.topBusySlots(1).empty());
+    }
+
+    SECTION("through snapshots") {
+        for (int i = 0; i < 3; i++) {
+            TripAnalyzer p;
+            p.ingestFile("P" + std::to_string(i) + ".csv");
+            REQUIRE(p.saveSnapshot("P" + std::to_string(i) + ".snap"));
+        }
+        TripAnalyzer merged;
+        for (int i = 0; i < 3; i++) {
+            TripAnalyzer p;
+            REQUIRE(p.loadSnapshot("P" + std::to_string(i) + ".snap"));
+            merged.merge(std::move(p));
+        }
+        requireSameRankings(rankingsOf(merged), exp);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D8 Append mode accumulates files and refreshes rankings", "[D]") {
+    std::string csv = mixedCsv(30000);
+    writeTripsCsv(csv);
+    TripAnalyzer whole;
+    whole.ingestFile("Trips.csv");
+    Rankings exp = rankingsOf(whole);
+
+    writePartCsvs(csv, 3);
+    TripAnalyzer a;
+    a.ingestFile("P0.csv");
+    Rankings first = rankingsOf(a);
+    a.ingestFile("P1.csv", IngestMode::Append);
+    a.ingestFile("P2.csv", IngestMode::Append);
+    requireSameRankings(rankingsOf(a), exp);
+
+    // Replace (the default) discards what was there.
+    a.ingestFile("P0.csv");
+    requireSameRankings(rankingsOf(a), first);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D9 Follow mode picks up appended rows only once complete", "[D]") {
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,Z1,2024-01-01 10:30\n"
+                  "2,Z2,2024-01-0");   // still being written
+
+    TripAnalyzer a;
+    a.follow("Trips.csv");
+    REQUIRE(a.poll() > 0);
+    requireZonesEq(a.topZones(10), {{"Z1", 1}});
+    REQUIRE(a.poll() == 0);
+
+    {
+        std::ofstream out("Trips.csv", std::ios::binary | std::ios::app);
+        out << "1 11:05\n3,Z1,2024-01-01 10:50\n4,Z3,2024";
+    }
+    REQUIRE(a.poll() > 0);
+    requireZonesEq(a.topZones(10), {{"Z1", 2}, {"Z2", 1}});
+    requireSlotsEq(a.topBusySlots(10), {{"Z1", 10, 2}, {"Z2", 11, 1}});
+
+    // Truncated and rewritten: start over.
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n5,Z9,2024-01-01 00:00\n");
+    REQUIRE(a.poll() > 0);
+    requireZonesEq(a.topZones(10), {{"Z9", 1}});
+
+    // Still following the same path after the restart.
+    {
+        std::ofstream out("Trips.csv", std::ios::binary | std::ios::app);
+        out << "6,Z9,2024-01-01 00:10\n";
+    }
+    REQUIRE(a.poll() > 0);
+    requireZonesEq(a.topZones(10), {{"Z9", 2}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "D10 Buffer and chunked ingest match file ingest", "[D]") {
+    std::string csv = mixedCsv(3000);
+    writeTripsCsv(csv);
+    TripAnalyzer ref;
+    ref.ingestFile("Trips.csv");
+    Rankings expected = rankingsOf(ref);
+
+    TripAnalyzer a;
+    a.ingestBuffer(csv.data(), csv.size());
+    requireSameRankings(rankingsOf(a), expected);
+
+    // Chunk sizes that split rows, fields and the header at every offset;
+    // the last chunk leaves the final row without its newline.
+    csv.pop_back();
+    for (std::size_t step : {1, 7, 64, 4096}) {
+        TripAnalyzer b;
+        for (std::size_t i = 0; i < csv.size(); i += step)
+            b.pushChunk(csv.data() + i, std::min(step, csv.size() - i));
+        b.finishChunks();
+        requireSameRankings(rankingsOf(b), expected);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D11 A FIFO is ingested as a stream", "[D]") {
+    std::string csv = mixedCsv(20000);
+    writeTripsCsv(csv);
+    TripAnalyzer ref;
+    ref.ingestFile("Trips.csv");
+
+    std::remove("Trips.fifo");
+    REQUIRE(mkfifo("Trips.fifo", 0600) == 0);
+    std::thread writer([&] {
+        std::ofstream out("Trips.fifo", std::ios::binary);
+        for (std::size_t i = 0; i < csv.size(); i += 1000)
+            out << csv.substr(i, 1000) << std::flush;
+    });
+    TripAnalyzer a;
+    a.ingestFile("Trips.fifo");
+    writer.join();
+    std::remove("Trips.fifo");
+
+    requireSameRankings(rankingsOf(a), rankingsOf(ref));
+}
+
+static void appendGzipMember(const std::string& path, const std::string& text) {
+    gzFile gz = gzopen(path.c_str(), "ab");
+    REQUIRE(gz != nullptr);
+    REQUIRE(gzwrite(gz, text.data(), (unsigned)text.size()) == (int)text.size());
+    gzclose(gz);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D12 Gzip input is detected and decompressed", "[D]") {
+    std::string csv = mixedCsv(200000);
+    writeTripsCsv(csv);
+    TripAnalyzer ref;
+    ref.ingestFile("Trips.csv");
+
+    // Two concatenated members, split in the middle of a row.
+    std::remove("Trips.csv.gz");
+    std::size_t cut = csv.size() / 3 + 5;
+    appendGzipMember("Trips.csv.gz", csv.substr(0, cut));
+    appendGzipMember("Trips.csv.gz", csv.substr(cut));
+
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv.gz");
+    requireSameRankings(rankingsOf(a), rankingsOf(ref));
+
+    // Detection is by content, not by name.
+    std::filesystem::rename("Trips.csv.gz", "Trips.dat");
+    TripAnalyzer b;
+    b.ingestFile("Trips.dat");
+    requireSameRankings(rankingsOf(b), rankingsOf(ref));
+
+    // A member cut short is rejected as a whole, like a missing file.
+    std::filesystem::resize_file("Trips.dat", std::filesystem::file_size("Trips.dat") - 100);
+    TripAnalyzer c;
+    c.ingestFile("Trips.csv");
+    c.ingestFile("Trips.dat");
+    REQUIRE(c.topZones(10).empty());
+    REQUIRE(c.topBusySlots(10).empty());
+    std::remove("Trips.dat");
+}
+
+TEST_CASE_METHOD(TripsFixture, "D13 Multi-file ingest equals appending the files in turn", "[D]") {
+    const int parts = 7;
+    writePartCsvs(mixedCsv(30000), parts);
+    std::vector<std::string> paths;
+    for (int i = 0; i < parts; i++) paths.push_back("P" + std::to_string(i) + ".csv");
+    paths.push_back("missing.csv");
+
+    TripAnalyzer serial;
+    for (auto& p : paths) serial.ingestFile(p, IngestMode::Append);
+    Rankings expected = rankingsOf(serial);
+
+    for (unsigned threads : {1u, 3u, 16u}) {
+        TripAnalyzer a;
+        a.setThreads(threads);
+        a.ingestFile("P0.csv");   // replaced, not added to
+        a.ingestFiles(paths);
+        requireSameRankings(rankingsOf(a), expected);
+    }
+
+    TripAnalyzer a;
+    a.setThreads(4);
+    a.ingestFile("P0.csv");
+    a.ingestFiles({"P1.csv", "P2.csv", "P3.csv", "P4.csv", "P5.csv", "P6.csv"}, IngestMode::Append);
+    requireSameRankings(rankingsOf(a), expected);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D14 Pipelined ingest matches in-place ingest", "[D]") {
+    std::string csv = mixedCsv(300000);   // spans several pipeline blocks
+    csv.pop_back();                       // last row without a newline
+    writeTripsCsv(csv);
+    TripAnalyzer ref;
+    ref.ingestFile("Trips.csv");
+
+    TripAnalyzer a;
+    a.setPipeline(true);
+    a.ingestFile("Trips.csv");
+    requireSameRankings(rankingsOf(a), rankingsOf(ref));
+
+    IngestStats s = a.ingestStats();
+    REQUIRE(s.bytes == csv.size());
+    REQUIRE(s.rows == 300000);
+    REQUIRE(s.totalMs > 0);
+}
+
+TEST_CASE_METHOD(TripsFixture, "D15 Timestamps must name a real date and time", "[D]") {
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,OK,2024-02-29 10:00\n"      // leap day
+                  "2,OK,2024-12-31 23:59:59\n"
+                  "3,OK,2024-1-5 7:05\n"         // tolerant layout
+                  "4,OK,05/01/2024 07:30\n"      // not Y-M-D: hour only
+                  "5,BAD,2024-99-99 10:00\n"
+                  "6,BAD,2023-02-29 10:00\n"
+                  "7,BAD,2024-04-31 10:00\n"
+                  "8,BAD,2024-00-10 10:00\n"
+                  "9,BAD,2024-01-01 24:00\n"
+                  "10,BAD,2024-01-01 10:60\n"
+                  "11,BAD,2024-01-01 10:00:61\n"
+                  "12,BAD,2024-13-01 7:00\n"
+                  "13,BAD,2024-01-01T10:00\n"
+                  "14,BAD,2O24-01-01 10:00x\n");
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    requireZonesEq(a.topZones(10), {{"OK", 4}});
+    requireSlotsEq(a.topBusySlots(10), {{"OK", 7, 2}, {"OK", 10, 1}, {"OK", 23, 1}});
+}
+
+TEST_CASE_METHOD(TripsFixture, "D16 Numbered zone ids keep exact names and tie-breaks", "[D]") {
+    // The first zone sets the <prefix><3 digits> layout; near-misses are
+    // distinct zones and must not be folded onto the same number.
+    writeTripsCsv("TripID,PickupZoneID,PickupTime\n"
+                  "1,ZONE042,2024-01-01 10:00\n"
+                  "2,ZONE42,2024-01-01 10:00\n"
+                  "3,ZONE0042,2024-01-01 10:00\n"
+                  "4,zone042,2024-01-01 10:00\n"
+                  "5,ZONE04x,2024-01-01 10:00\n"
+                  "6,ZONE999,2024-01-01 11:00\n"
+                  "7,ZONE007,2024-01-01 11:00\n"
+                  "8,ZONE042,2024-01-01 12:00\n"
+                  "9,ZONE999,2024-01-01 12:00\n");
+    TripAnalyzer a;
+    a.ingestFile("Trips.csv");
+    requireZonesEq(a.topZones(10), {{"ZONE042", 2}, {"ZONE999", 2}, {"ZONE0042", 1},
+                                    {"ZONE007", 1}, {"ZONE04x", 1}, {"ZONE42", 1},
+                                    {"zone042", 1}});
+
+    // Counts restored from a snapshot line up with new rows for the same names.
+    REQUIRE(a.saveSnapshot("Trips.snap"));
+    TripAnalyzer b;
+    REQUIRE(b.loadSnapshot("Trips.snap"));
+    b.ingestFile("Trips.csv", IngestMode::Append);
+    requireZonesEq(b.topZones(2), {{"ZONE042", 4}, {"ZONE999", 4}});
+    std::remove("Trips.snap");
+}
+
+TEST_CASE_METHOD(TripsFixture, "D17 Every aggregation engine gives the same rankings", "[D]") {
+    const AggregationEngine engines[] = {AggregationEngine::Auto, AggregationEngine::Tiny,
+                                         AggregationEngine::Hash, AggregationEngine::Radix};
+
+    SECTION("mixed zones") {
+        writeTripsCsv(mixedCsv(20000));
+        TripAnalyzer ref;
+        ref.setEngine(AggregationEngine::Hash);
+        ref.ingestFile("Trips.csv");
+        for (AggregationEngine e : engines) {
+            for (unsigned threads : {1u, 4u}) {
+                TripAnalyzer a;
+                a.setEngine(e);
+                a.setThreads(threads);
+                a.ingestFile("Trips.csv");
+                requireSameRankings(rankingsOf(a), rankingsOf(ref));
+            }
+        }
+
+        // The sidecar's row log stays in file order under radix grouping.
+        TripAnalyzer cached;
+        cached.setEngine(AggregationEngine::Radix);
+        cached.setSidecarCache(true);
+        cached.ingestFile("Trips.csv");
+        cached.ingestFile("Trips.csv");
+        requireSameRankings(rankingsOf(cached), rankingsOf(ref));
+        std::remove("Trips.csv.tacache");
+    }
+
+    SECTION("the sample picks the engine") {
+        std::string few = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 16; i++) few += "1,Z" + std::to_string(i % 2 + 1) + ",2024-01-01 10:30\n";
+        writeTripsCsv(few);
+        TripAnalyzer a;
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.ingestStats().engine == AggregationEngine::Tiny);
+        requireZonesEq(a.topZones(10), {{"Z1", 8}, {"Z2", 8}});
+
+        writeTripsCsv(mixedCsv(20000));
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.ingestStats().engine == AggregationEngine::Hash);
+        // 997 zones: the estimate follows the repeats, not the row count.
+        REQUIRE(a.ingestStats().estimatedZones > 500);
+        REQUIRE(a.ingestStats().estimatedZones < 2000);
+
+        std::string csv = "TripID,PickupZoneID,PickupTime\n";
+        for (int i = 0; i < 300000; i++)
+            csv += std::to_string(i) + ",U" + std::to_string(i) + ",2024-01-01 10:00\n";
+        writeTripsCsv(csv);
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.ingestStats().engine == AggregationEngine::Radix);
+        REQUIRE(a.ingestStats().estimatedZones >= 250000);
+        requireZonesEq(a.topZones(2), {{"U0", 1}, {"U1", 1}});
+
+        // A forced engine is used as is, without sampling.
+        a.setEngine(AggregationEngine::Hash);
+        a.ingestFile("Trips.csv");
+        REQUIRE(a.ingestStats().engine == AggregationEngine::Hash);
+        REQUIRE(a.ingestStats().estimatedZones == 0);
+        requireZonesEq(a.topZones(2), {{"U0", 1}, {"U1", 1}});
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D18 Runs of repeated zones and hours are counted exactly", "[D]") {
+    // Runs of one zone that change hour mid-run, alternate with another
+    // zone, and differ from the remembered name only after 8 bytes.
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    std::map<std::pair<std::string, int>, long long> expected;
+    const char* names[] = {"Z2", "Z2", "Z2", "Z3", "LONGZONE_A", "LONGZONE_B", "Z2"};
+    int id = 0;
+    for (int run = 0; run < 200; run++) {
+        std::string zone = names[run % 7];
+        for (int i = 0; i < 1 + run % 13; i++) {
+            int hour = (run + i / 5) % 24;
+            csv += std::to_string(id++) + "," + zone + ",2024-01-01 " + zpad(hour, 2) + ":15\n";
+            expected[{zone, hour}]++;
+        }
+    }
+    writeTripsCsv(csv);
+
+    for (AggregationEngine e : {AggregationEngine::Tiny, AggregationEngine::Hash}) {
+        TripAnalyzer a;
+        a.setEngine(e);
+        a.ingestFile("Trips.csv");
+        auto slots = a.topBusySlots(1000);
+        REQUIRE(slots.size() == expected.size());
+        for (const auto& s : slots) REQUIRE(expected[{s.zone, s.hour}] == s.count);
+    }
+}
+
+TEST_CASE_METHOD(TripsFixture, "D19 Batched lookups resolve zones first seen within a batch", "[D]") {
+    // Zones recur a few rows apart, so a batch often names a zone it has
+    // itself just added; numbered and free-form names are interleaved, and
+    // some numbers are too sparse for the numbered index to take.
+    std::string csv = "TripID,PickupZoneID,PickupTime\n";
+    std::map<std::string, long long> expected;
+    for (int i = 0; i < 5000; i++) {
+        std::string zone = i % 3 == 0   ? "N" + zpad(i % 37, 7)
+                           : i % 7 == 0 ? "N" + zpad(1000000 + i % 5 * 1999999, 7)
+                                        : "free-form-zone-" + std::to_string(i % 11);
+        csv += std::to_string(i) + "," + zone + ",2024-01-01 " + zpad(i % 24, 2) + ":00\n";
+        expected[zone]++;
+    }
+    writeTripsCsv(csv);
+
+    TripAnalyzer a;
+    a.setEngine(AggregationEngine::Hash);
+    a.setSidecarCache(true);
+    for (int pass = 0; pass < 2; pass++) {   // parse, then reload the row log
+        a.ingestFile("Trips.csv");
+        auto zones = a.topZones(100);
+        REQUIRE(zones.size() == expected.size());
+        for (const auto& z : zones) REQUIRE(expected[z.zone] == z.count);
+    }
+    std::remove("Trips.csv.tacache");
+}
+
+TEST_CASE("D20 Every CSV scan kernel agrees with the scalar one", "[D]") {
+    std::vector<ScanKernel> kernels = scanKernels();
+    REQUIRE(std::string(kernels[0].name) == "scalar");
+
+    // Random blocks over all byte values, plus ones dense in the
+    // structural characters, including bytes >= 0x80.
+    std::mt19937 rng(123);
+    const char dense[] = {',', '\n', ',', '\n', 'a', '\r', '"', (char)0x80, (char)0xAC, (char)0x8A};
+    for (int round = 0; round < 2000; round++) {
+        char block[64];
+        for (char& c : block)
+            c = round % 2 ? (char)(rng() & 0xFF) : dense[rng() % sizeof dense];
+
+        uint64_t wantCommas, wantNewlines;
+        kernels[0].scan(block, wantCommas, wantNewlines);
+        for (const ScanKernel& k : kernels) {
+            INFO(k.name);
+            uint64_t commas = 0, newlines = 0;
+            k.scan(block, commas, newlines);
+            REQUIRE(commas == wantCommas);
+            REQUIRE(newlines == wantNewlines);
+        }
+    }
+}
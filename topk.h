@@ -0,0 +1,45 @@
+#ifndef TOPK_H
+#define TOPK_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+// Bounded top-k selection over a stream. The k best items seen so far sit
+// in a heap whose root is the worst of them, so a candidate that does not
+// make the cut costs one comparison and one that does costs O(log k).
+// `better(a, b)` must be a strict weak order that ranks a ahead of b.
+template <class T, class Better>
+class TopK {
+public:
+    TopK(size_t k, Better better) : k(k), better(better) {}
+
+    void push(const T& x) {
+        if (heap.size() < k) {
+            heap.push_back(x);
+            std::push_heap(heap.begin(), heap.end(), better);
+        } else if (k > 0 && better(x, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), better);
+            heap.back() = x;
+            std::push_heap(heap.begin(), heap.end(), better);
+        }
+    }
+
+    // The kept items, best first.
+    std::vector<T> take() {
+        std::sort(heap.begin(), heap.end(), better);
+        return std::move(heap);
+    }
+
+private:
+    size_t k;
+    Better better;
+    std::vector<T> heap;
+};
+
+template <class T, class Better>
+TopK<T, Better> makeTopK(size_t k, Better better) {
+    return TopK<T, Better>(k, better);
+}
+
+#endif
@@ -0,0 +1,264 @@
+#ifndef ZONE_DICT_H
+#define ZONE_DICT_H
+
+#include <cstdint>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Append-only store for interned strings. Strings are laid out back to back
+// in one buffer and referred to by 32-bit offset, so a name costs its bytes
+// plus whatever index points at it. Views are only valid until the next
+// append.
+class StringArena {
+public:
+    uint32_t append(std::string_view s) {
+        uint32_t off = (uint32_t)bytes.size();
+        bytes.insert(bytes.end(), s.begin(), s.end());
+        return off;
+    }
+
+    std::string_view view(uint32_t off, uint32_t len) const {
+        return std::string_view(bytes.data() + off, len);
+    }
+
+    bool equals(uint32_t off, std::string_view s) const {
+        return std::memcmp(bytes.data() + off, s.data(), s.size()) == 0;
+    }
+
+    size_t size() const { return bytes.size(); }
+    const char* data() const { return bytes.data(); }
+    void assign(std::string_view s) { bytes.assign(s.begin(), s.end()); }
+    void reserve(size_t n) { bytes.reserve(n); }
+    void clear() { bytes.clear(); }
+    size_t memoryBytes() const { return bytes.capacity(); }
+
+private:
+    std::vector<char> bytes;
+};
+
+// Open-addressing dictionary from zone name to a dense id (0, 1, 2, ... in
+// insertion order). Each slot holds the top 32 bits of the key's hash as a
+// fingerprint, the id and the key's place in the arena, and probing is
+// linear. Keys are interned in a StringArena, so adding a zone allocates no
+// node or string of its own and key(id) is the only copy of a name.
+//
+// The home slot comes from the top bits of the fingerprint. That way the
+// table can grow without rehashing any key, and keys whose hashes share a
+// prefix land in the same region of the table.
+class ZoneDict {
+public:
+    static constexpr uint32_t npos = ~0u;
+
+    struct Slot {
+        uint32_t tag;
+        uint32_t id;   // npos marks an empty slot
+        uint32_t off;  // key bytes, copied from offsets so a probe
+        uint32_t len;  // touches the arena directly
+    };
+
+    ZoneDict() { clear(); }
+
+    static uint64_t hash(std::string_view s) {
+        const uint64_t m = 0x9E3779B97F4A7C15ULL;
+        const char* p = s.data();
+        size_t n = s.size();
+        uint64_t h = n * m;
+        for (; n >= 8; p += 8, n -= 8) {
+            uint64_t w;
+            std::memcpy(&w, p, 8);
+            h = (h ^ w) * m;
+            h ^= h >> 32;
+        }
+        if (n) {
+            uint64_t w = 0;
+            std::memcpy(&w, p, n);
+            h = (h ^ w) * m;
+        }
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 32;
+        return h;
+    }
+
+    size_t size() const { return offsets.size() - 1; }
+
+    std::string_view key(uint32_t id) const {
+        return arena.view(offsets[id], offsets[id + 1] - offsets[id]);
+    }
+
+    // Fingerprint of k. Its top bits pick k's home slot, so keys sorted by
+    // tag are probed in slot order.
+    static uint32_t tagOf(std::string_view k) { return (uint32_t)(hash(k) >> 32); }
+
+    uint32_t find(std::string_view k) const { return find(k, tagOf(k)); }
+
+    // Id of k, adding it with the next id if it is not present yet.
+    uint32_t intern(std::string_view k) { return intern(k, tagOf(k)); }
+
+    // Starts loading the home slot of a key with this tag, so a lookup
+    // issued a little later does not stall on it.
+    void prefetch(uint32_t tag) const { __builtin_prefetch(&slots[tag >> shift]); }
+
+    // intern() for a key whose tag the caller already has.
+    uint32_t intern(std::string_view k, uint32_t tag) {
+        uint32_t id = find(k, tag);
+        if (id != npos) return id;
+
+        if ((size() + 1) * 4 > slots.size() * 3) grow();
+        id = (uint32_t)size();
+        uint32_t off = arena.append(k);
+        offsets.push_back((uint32_t)arena.size());
+        place(Slot{tag, id, off, (uint32_t)k.size()});
+        return id;
+    }
+
+    // Makes room for n keys totalling arenaBytes without further growth.
+    void reserve(size_t n, size_t arenaBytes) {
+        while (n * 4 > slots.size() * 3) grow();
+        arena.reserve(arenaBytes);
+        offsets.reserve(n + 1);
+    }
+
+    void clear() {
+        slots.assign(16, Slot{0, npos, 0, 0});
+        shift = 28;
+        arena.clear();
+        offsets.assign(1, 0);
+    }
+
+    // Heap bytes held by the table, the arena and the offsets.
+    size_t memoryBytes() const {
+        return slots.capacity() * sizeof(Slot) + arena.memoryBytes() +
+               offsets.capacity() * sizeof(uint32_t);
+    }
+
+    // Raw storage, for snapshots. A dictionary restored from these pieces
+    // answers lookups straight away, without rehashing any key.
+    const std::vector<Slot>& rawSlots() const { return slots; }
+    const std::vector<uint32_t>& rawOffsets() const { return offsets; }
+    std::string_view rawArena() const { return std::string_view(arena.data(), arena.size()); }
+
+    // Adopts storage taken from rawSlots(), rawOffsets() and rawArena().
+    // Sizes and bounds are checked first; if they do not add up, the
+    // dictionary is left untouched and false is returned.
+    bool restore(const Slot* s, size_t slotCount, const uint32_t* off, size_t keys,
+                 std::string_view bytes) {
+        if (slotCount < 16 || slotCount > (size_t(1) << 32) || (slotCount & (slotCount - 1)) ||
+            keys * 4 > slotCount * 3 || off[0] != 0 || off[keys] != bytes.size())
+            return false;
+        for (size_t i = 0; i < keys; i++)
+            if (off[i] > off[i + 1]) return false;
+        size_t used = 0;
+        for (size_t i = 0; i < slotCount; i++) {
+            if (s[i].id == npos) continue;
+            if (s[i].id >= keys || (size_t)s[i].off + s[i].len > bytes.size()) return false;
+            used++;
+        }
+        if (used != keys) return false;
+
+        slots.assign(s, s + slotCount);
+        shift = 32;
+        for (size_t n = slotCount; n > 1; n >>= 1) shift--;
+        offsets.assign(off, off + keys + 1);
+        arena.assign(bytes);
+        return true;
+    }
+
+    // Slots in the table; grows by doubling as keys are added.
+    size_t capacity() const { return slots.size(); }
+
+private:
+    uint32_t find(std::string_view k, uint32_t tag) const {
+        size_t mask = slots.size() - 1;
+        for (size_t i = tag >> shift;; i = (i + 1) & mask) {
+            const Slot& s = slots[i];
+            if (s.id == npos) return npos;
+            if (s.tag == tag && s.len == k.size() && arena.equals(s.off, k)) return s.id;
+        }
+    }
+
+    void place(const Slot& s) {
+        size_t mask = slots.size() - 1;
+        size_t i = s.tag >> shift;
+        while (slots[i].id != npos) i = (i + 1) & mask;
+        slots[i] = s;
+    }
+
+    void grow() {
+        std::vector<Slot> old;
+        old.swap(slots);
+        slots.assign(old.size() * 2, Slot{0, npos, 0, 0});
+        shift--;
+        for (const Slot& s : old)
+            if (s.id != npos) place(s);
+    }
+
+    std::vector<Slot> slots;
+    int shift;                       // 32 - log2(slots.size())
+    StringArena arena;
+    std::vector<uint32_t> offsets;   // key i is arena[offsets[i], offsets[i + 1])
+};
+
+// Shortcut from zone names of the form <prefix><fixed number of digits>,
+// such as "ZONE042" or "Z0000017", to their dictionary ids: the number
+// indexes a dense vector, so a repeat sighting costs a prefix compare and
+// a digit parse instead of a hash and a probe. The layout is learned from
+// the first name seen. Names that do not fit it (other prefix or width, or
+// a number too large or too sparse to index) return false and go through
+// the dictionary, which stays the owner of every name; this is only a
+// cache in front of it.
+class ZoneNumberIndex {
+public:
+    static constexpr uint32_t kMaxNumber = 1u << 24;
+
+    // Slot for k's number, or nullptr if k does not fit the layout. The
+    // slot holds ZoneDict::npos until set. `zones` is how many names the
+    // dictionary holds: the vector only grows to numbers that are dense
+    // relative to it, so a few sparse large numbers fall back to hashing
+    // instead of allocating a slot for every number below them.
+    uint32_t* slot(std::string_view k, size_t zones) {
+        if (width == kUnknown) learn(k);
+        if (k.size() != prefix.size() + width || width == 0) return nullptr;
+        if (std::memcmp(k.data(), prefix.data(), prefix.size()) != 0) return nullptr;
+
+        uint32_t n = 0;
+        for (size_t i = prefix.size(); i < k.size(); i++) {
+            uint32_t d = (uint32_t)(unsigned char)k[i] - '0';
+            if (d > 9) return nullptr;
+            n = n * 10 + d;
+        }
+        if (n >= ids.size()) {
+            if (n >= kMaxNumber || n >= 4 * zones + 1024) return nullptr;
+            size_t grown = std::min<size_t>(std::max<size_t>(n + 1, ids.size() * 2), kMaxNumber);
+            ids.resize(grown, ZoneDict::npos);
+        }
+        return &ids[n];
+    }
+
+    void clear() {
+        width = kUnknown;
+        prefix.clear();
+        ids.clear();
+    }
+
+private:
+    static constexpr size_t kUnknown = ~size_t(0);
+
+    void learn(std::string_view k) {
+        size_t digits = 0;
+        while (digits < k.size() && digits < 9 && k[k.size() - 1 - digits] >= '0' &&
+               k[k.size() - 1 - digits] <= '9')
+            digits++;
+        width = digits;   // 0: no trailing number, shortcut disabled
+        prefix.assign(k.data(), k.size() - digits);
+    }
+
+    size_t width = kUnknown;
+    std::string prefix;
+    std::vector<uint32_t> ids;
+};
+
+#endif